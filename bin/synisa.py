@@ -0,0 +1,137 @@
+# generated by synisa from opcodes.h, do not edit
+
+ENTRY_SIZE = 3
+
+# mnemonic: (opcode, operand layout)
+OPCODES = {
+    "halt": (0x01, "NONE"),
+    "mov": (0x02, "REG_REG"),
+    "printc": (0x03, "REG"),
+    "printcs": (0x04, "STRING"),
+    "printi": (0x05, "REG"),
+    "printh": (0x06, "REG"),
+    "setr": (0x07, "REG_IMM"),
+    "inc": (0x08, "REG"),
+    "dec": (0x09, "REG"),
+    "add": (0x0a, "REG_REG"),
+    "sub": (0x0b, "REG_REG"),
+    "mul": (0x0c, "REG_REG"),
+    "div": (0x0d, "REG_REG"),
+    "jmp": (0x0e, "ADDR"),
+    "jnz": (0x0f, "REG_ADDR"),
+    "jz": (0x10, "REG_ADDR"),
+    "shl": (0x11, "REG_REG"),
+    "shr": (0x12, "REG_REG"),
+    "xor": (0x13, "REG_REG"),
+    "or": (0x14, "REG_REG"),
+    "and": (0x15, "REG_REG"),
+    "pop": (0x16, "REG"),
+    "push": (0x17, "IMM"),
+    "pushr": (0x18, "REG"),
+    "getip": (0x19, "REG"),
+    "peek": (0x1a, "REG"),
+    "mod": (0x1b, "REG_REG"),
+    "lt": (0x1c, "REG_REG"),
+    "gt": (0x1d, "REG_REG"),
+    "ret": (0x1e, "NONE"),
+    "call": (0x1f, "ADDR"),
+    "printis": (0x20, "NONE"),
+    "adds": (0x21, "NONE"),
+    "subs": (0x22, "NONE"),
+    "muls": (0x23, "NONE"),
+    "divs": (0x24, "NONE"),
+    "lts": (0x25, "NONE"),
+    "gts": (0x26, "NONE"),
+    "sys": (0x27, "HOST"),
+    "jmps": (0x28, "REL"),
+    "jnzs": (0x29, "REG_REL"),
+    "jzs": (0x2a, "REG_REL"),
+    "calls": (0x2b, "REL"),
+    "lds": (0x2c, "REG_IMM"),
+    "sts": (0x2d, "REG_IMM"),
+    "shls": (0x2e, "NONE"),
+    "shrs": (0x2f, "NONE"),
+    "jlt": (0x30, "REG_REG_ADDR"),
+    "jgt": (0x31, "REG_REG_ADDR"),
+    "jeq": (0x32, "REG_REG_ADDR"),
+    "jne": (0x33, "REG_REG_ADDR"),
+    "jle": (0x34, "REG_REG_ADDR"),
+    "jge": (0x35, "REG_REG_ADDR"),
+    "jlti": (0x36, "REG_IMM_ADDR"),
+    "jgti": (0x37, "REG_IMM_ADDR"),
+    "jeqi": (0x38, "REG_IMM_ADDR"),
+    "jnei": (0x39, "REG_IMM_ADDR"),
+    "jlei": (0x3a, "REG_IMM_ADDR"),
+    "jgei": (0x3b, "REG_IMM_ADDR"),
+    "spawn": (0x3c, "REG_ADDR"),
+    "join": (0x3d, "REG"),
+    "ld": (0x3e, "REG_REG"),
+    "st": (0x3f, "REG_REG"),
+    "xadd": (0x40, "REG_REG"),
+    "cas": (0x41, "REG_REG"),
+    "fence": (0x42, "NONE"),
+    "send": (0x43, "REG_REG"),
+    "recv": (0x44, "REG_REG_ADDR"),
+    "tryrecv": (0x45, "REG_REG_ADDR"),
+    "printp": (0x46, "ADDR"),
+    "pool": (0x47, "POOL"),
+    "callw": (0x48, "ADDR"),
+    "retw": (0x49, "NONE"),
+    "trap": (0xff, "NONE"),
+}
+
+# bytes after the opcode, strings add their characters and terminator
+OPERAND_SIZES = {
+    "NONE": 0,
+    "REG": 1,
+    "REG_REG": 2,
+    "REG_IMM": 3,
+    "IMM": 2,
+    "ADDR": 2,
+    "REG_ADDR": 3,
+    "STRING": 0,
+    "HOST": 1,
+    "REL": 1,
+    "REG_REL": 2,
+    "REG_REG_ADDR": 4,
+    "REG_IMM_ADDR": 5,
+    "POOL": 2,
+}
+
+# long branch mnemonic: short form with a signed 8-bit displacement
+SHORT_BRANCHES = {
+    "jmp": "jmps",
+    "jnz": "jnzs",
+    "jz": "jzs",
+    "call": "calls",
+}
+
+SHORT_BRANCH_MIN = -128
+SHORT_BRANCH_MAX = 127
+
+# inline string mnemonic: form printing the string from the pool
+POOLED_STRINGS = {
+    "printcs": "printp",
+}
+
+# the pool instruction and its size, then a length before each string
+POOL_HEADER_SIZE = 3
+POOL_LENGTH_SIZE = 2
+
+REGISTERS = {
+    "r0": 0x00,
+    "r1": 0x01,
+    "r2": 0x02,
+    "r3": 0x03,
+    "r4": 0x04,
+    "r5": 0x05,
+    "r6": 0x06,
+    "r7": 0x07,
+    "r8": 0x08,
+    "r9": 0x09,
+    "r10": 0x0a,
+    "ax": 0x0b,
+    "bx": 0x0c,
+    "cx": 0x0d,
+    "dx": 0x0e,
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# checks that threads.sasm scales across cores: four threads doing four times
+# the work of one should take about as long as one, given four cpus. fails
+# when they get less than three quarters of that. run with `make scaling`.
+
+set -e
+bin=${BIN_DIR:-bin}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# 256 passes instead of 16, so a run is long enough to time
+sed 's/setr r2 0x10 ; passes/setr r2 0x100 ; passes/' examples/threads.sasm > "$dir/four.sasm"
+sed '/^    \(spawn\|join\) r\(8\|9\|10\)/d' "$dir/four.sasm" > "$dir/one.sasm"
+"$bin/synas" -o "$dir/four.img" "$dir/four.sasm"
+"$bin/synas" -o "$dir/one.img" "$dir/one.sasm"
+
+# best of three runs in milliseconds
+best() {
+    fastest=
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        "$bin/synthetic" "$1" > /dev/null
+        end=$(date +%s%N)
+        took=$(( (end - start) / 1000000 ))
+        if [ -z "$fastest" ] || [ "$took" -lt "$fastest" ]; then fastest=$took; fi
+    done
+    echo "$fastest"
+}
+
+one=$(best "$dir/one.img")
+four=$(best "$dir/four.img")
+cpus=$(getconf _NPROCESSORS_ONLN)
+ideal=$(( cpus < 4 ? cpus : 4 ))
+# speedup and the least accepted, both in hundredths
+speedup=$(( 4 * one * 100 / four ))
+least=$(( ideal * 75 ))
+
+printf "one thread %d ms, four threads %d ms: %d.%02dx on %d cpus, at least %d.%02dx expected\n" \
+    "$one" "$four" $(( speedup / 100 )) $(( speedup % 100 )) "$cpus" $(( least / 100 )) $(( least % 100 ))
+[ "$speedup" -ge "$least" ]
@@ -1,183 +1,452 @@
-#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "assembler.h"
+#include "cache.h"
+#include "host.h"
+#include "isa.h"
+#include "lexer.h"
+#include "object.h"
 #include "vm.h"
 
-Assembler assembler;
-
-#define SIZE 20
-
 typedef struct {
-    uint16_t value;
-    const char* key;
-} DataItem;
-
-DataItem* labelArray[SIZE];
-DataItem* nullItem;
-
-uint32_t hashString(const char* str) {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < strlen(str); i++) {
-        hash ^= (uint8_t)str[i];
-        hash *= 16777619;
+    Assembler* assembler;
+    Lexer lexer;
+    const char* path;
+    uint32_t file;
+} Parser;
+
+static void parseSource(Parser* parser);
+
+static void emitByte(Assembler* assembler, uint8_t byte) {
+    if(assembler->capacity < assembler->count + 1) {
+        int oldCapacity = assembler->capacity;
+        assembler->capacity = GROW_CAPACITY(oldCapacity);
+        GROW_BUFFER(assembler);
+        if(assembler->buffer == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
     }
-    return (int)hash;
-}
 
-static int hashCode(const char* str) {
-    return hashString(str) % SIZE;
+    assembler->buffer[assembler->count] = byte;
+    assembler->count++;
 }
 
-DataItem* searchKey(const char* key, DataItem* hashArray[]) {
-    int hashIndex = hashCode(key);
-    if(hashArray[hashIndex] != NULL)
-        return hashArray[hashIndex];
+static void emitBytes(Assembler* assembler, const uint8_t* bytes, int length) {
+    if(assembler->capacity < assembler->count + length) {
+        while(assembler->capacity < assembler->count + length)
+            assembler->capacity = GROW_CAPACITY(assembler->capacity);
+        GROW_BUFFER(assembler);
+        if(assembler->buffer == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+    }
 
-    return NULL;
+    memcpy(assembler->buffer + assembler->count, bytes, length);
+    assembler->count += length;
 }
 
-void insertKey(const char* key, uint16_t data, DataItem* hashArray[]) {
-    DataItem* item = (DataItem*)malloc(sizeof(DataItem));
-    item->value = data;
-    item->key = key;
+static void emitByte16(Assembler* assembler, uint16_t bytes) {
+    uint8_t msb = bytes >> 8;
+    uint8_t lsb = bytes;
+    emitByte(assembler, msb);
+    emitByte(assembler, lsb);
+}
 
-    int hashIndex = hashCode(key);
+static Instruction* addInstruction(Assembler* assembler, uint8_t opcode) {
+    if(assembler->instructionCapacity < assembler->instructionCount + 1) {
+        assembler->instructionCapacity = GROW_CAPACITY(assembler->instructionCapacity);
+        assembler->instructions = realloc(assembler->instructions, sizeof(Instruction) * assembler->instructionCapacity);
+        if(assembler->instructions == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+    }
 
-    hashArray[hashIndex] = item;
+    Instruction* instruction = &assembler->instructions[assembler->instructionCount++];
+    memset(instruction, 0, sizeof(Instruction));
+    instruction->opcode = opcode;
+    return instruction;
 }
 
-DataItem* deleteKey(DataItem* item, DataItem* hashArray[]) {
-    const char* key = item->key;
+static void addFixup(Assembler* assembler, Symbol* label, bool string) {
+    if(assembler->fixupCapacity < assembler->fixupCount + 1) {
+        assembler->fixupCapacity = GROW_CAPACITY(assembler->fixupCapacity);
+        assembler->fixups = realloc(assembler->fixups, sizeof(Fixup) * assembler->fixupCapacity);
+        if(assembler->fixups == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+    }
 
-    int hashIndex = hashCode(key);
+    assembler->fixups[assembler->fixupCount].label = label;
+    assembler->fixups[assembler->fixupCount].offset = assembler->count;
+    assembler->fixups[assembler->fixupCount].string = string;
+    assembler->fixupCount++;
+}
 
-    hashArray[hashIndex] = nullItem;
+static void emitLabel(Assembler* assembler, Symbol* label) {
+    addFixup(assembler, label, false);
+    emitByte16(assembler, 0x0000);
+}
 
-    return NULL;
+static void emitPoolString(Assembler* assembler, Symbol* string) {
+    addFixup(assembler, string, true);
+    emitByte16(assembler, 0x0000);
 }
 
-static void emitByte(uint8_t byte) {
-    if(assembler.capacity < assembler.count + 1) {
-        int oldCapacity = assembler.capacity;
-        assembler.capacity = GROW_CAPACITY(oldCapacity);
-        assembler.buffer = GROW_BUFFER(assembler);
+// code that jumps to numeric addresses or reads the ip depends on the exact
+// layout, instructions can't change size or move
+bool isRelocatable(Assembler* assembler) {
+    for(int i = 0; i < assembler->instructionCount; i++) {
+        Instruction* instruction = &assembler->instructions[i];
+        if(instruction->opcode == OP_GETIP) return false;
+        if(addressOffset(instructionInfo[instruction->opcode].layout) && instruction->label == NULL) return false;
     }
-
-    assembler.buffer[assembler.count] = byte;
-    assembler.count++;
-    assembler.bytesWritten++;
+    return true;
 }
 
-static void padJumpToMain() {
-    uint16_t dest;
-    if(searchKey("main", labelArray) == NULL) {
-        fprintf(stderr, "main label does not exist.\n");
-        exit(1);
-    } else {
-        dest = searchKey("main", labelArray)->value;
-    }
+static uint32_t instructionSize(Instruction* instruction) {
+    if(instruction->shortForm)
+        return 1 + operandSize(instructionInfo[shortBranch(instruction->opcode)].layout);
+    if(instruction->opcode == OP_PRINTCS)
+        return 1 + instruction->string->length + 1;
+    return 1 + operandSize(instructionInfo[instruction->opcode].layout);
+}
 
-    uint8_t* bbuffer = malloc(3*sizeof(uint8_t));
-    bbuffer[0] = OP_JMP;
-    bbuffer[1] = dest >> 8;
-    bbuffer[2] = (uint8_t)dest;
+static int branchTarget(Assembler* assembler, Instruction* instruction) {
+    Entry* entry = tableGet(&assembler->labels, instruction->label);
+    return (entry == NULL || !entry->defined) ? -1 : (int)entry->value;
+}
 
-    int length = assembler.capacity + (sizeof(bbuffer) / sizeof(uint8_t));
+// every branch to a label in this unit starts short and is widened when its
+// target is out of reach. widening only moves targets further away, so this
+// settles once a pass widens nothing. addresses[i] is the offset of
+// instruction i, addresses[count] the size of the code.
+static void relaxBranches(Assembler* assembler, uint32_t* addresses) {
+    bool relocatable = isRelocatable(assembler);
+    for(int i = 0; i < assembler->instructionCount; i++) {
+        Instruction* instruction = &assembler->instructions[i];
+        instruction->shortForm = relocatable && shortBranch(instruction->opcode) &&
+            branchTarget(assembler, instruction) >= 0;
+        // literals move to the string pool unless the layout has to stay as written
+        if(relocatable && pooledString(instruction->opcode)) instruction->opcode = pooledString(instruction->opcode);
+    }
 
-    uint8_t* endbuffer = malloc(length*sizeof(uint8_t));
-    memcpy(endbuffer, bbuffer, 3*sizeof(uint8_t));
-    memcpy(endbuffer+3, assembler.buffer, assembler.capacity*sizeof(uint8_t));
+    bool widened;
+    do {
+        uint32_t address = 0;
+        for(int i = 0; i < assembler->instructionCount; i++) {
+            addresses[i] = address;
+            address += instructionSize(&assembler->instructions[i]);
+        }
+        addresses[assembler->instructionCount] = address;
 
-    assembler.buffer = endbuffer;
-    assembler.capacity = length;
+        widened = false;
+        for(int i = 0; i < assembler->instructionCount; i++) {
+            Instruction* instruction = &assembler->instructions[i];
+            if(!instruction->shortForm) continue;
+            int64_t displacement = (int64_t)addresses[branchTarget(assembler, instruction)] - addresses[i + 1];
+            if(displacement < SHORT_BRANCH_MIN || displacement > SHORT_BRANCH_MAX) {
+                instruction->shortForm = false;
+                widened = true;
+            }
+        }
+    } while(widened);
 }
 
-static void emitByte16(uint16_t bytes) {
-    uint8_t msb = bytes >> 8;
-    uint8_t lsb = bytes;
-    emitByte(msb);
-    emitByte(lsb);
-}
+// records the source line of the instruction at offset, unless the last entry already has it
+static void addLine(Assembler* assembler, uint32_t offset, Instruction* instruction) {
+    if(assembler->lineCount > 0) {
+        SourceLine* last = &assembler->lines[assembler->lineCount - 1];
+        if(last->file == instruction->file && last->line == instruction->line) return;
+    }
 
-static void writeBuffer(FILE* file) {
-    fwrite(assembler.buffer, sizeof(uint8_t), assembler.capacity, file);
+    if(assembler->lineCapacity < assembler->lineCount + 1) {
+        assembler->lineCapacity = GROW_CAPACITY(assembler->lineCapacity);
+        assembler->lines = realloc(assembler->lines, sizeof(SourceLine) * assembler->lineCapacity);
+        if(assembler->lines == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+    }
+    assembler->lines[assembler->lineCount].offset = offset;
+    assembler->lines[assembler->lineCount].file = instruction->file;
+    assembler->lines[assembler->lineCount].line = instruction->line;
+    assembler->lineCount++;
 }
 
-void trim(char * s) {
-    char* p = s;
-    int l = strlen(p);
+// lay the instruction list out as bytes, labels hold instruction indices
+// until here and are converted to code offsets once every address is known
+static void encodeInstructions(Assembler* assembler, bool debug) {
+    uint32_t* addresses = malloc(sizeof(uint32_t) * (assembler->instructionCount + 1));
+    if(addresses == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    relaxBranches(assembler, addresses);
+
+    for(int i = 0; i < assembler->instructionCount; i++) {
+        Instruction* instruction = &assembler->instructions[i];
+        if(debug) addLine(assembler, addresses[i], instruction);
+        if(instruction->shortForm) {
+            uint8_t opcode = shortBranch(instruction->opcode);
+            emitByte(assembler, opcode);
+            if(instructionInfo[opcode].layout == LAYOUT_REG_REL)
+                emitByte(assembler, instruction->reg1);
+            emitByte(assembler, (uint8_t)(addresses[branchTarget(assembler, instruction)] - addresses[i + 1]));
+            continue;
+        }
 
-    while(isspace(p[l - 1])) p[--l] = 0;
-    while(*p && isspace(*p)) ++p, --l;
+        emitByte(assembler, instruction->opcode);
+        switch(instructionInfo[instruction->opcode].layout) {
+            case LAYOUT_NONE:
+                break;
+            case LAYOUT_REG:
+                emitByte(assembler, instruction->reg1);
+                break;
+            case LAYOUT_REG_REG:
+                emitByte(assembler, instruction->reg1);
+                emitByte(assembler, instruction->reg2);
+                break;
+            case LAYOUT_REG_IMM:
+                emitByte(assembler, instruction->reg1);
+                emitByte16(assembler, instruction->value);
+                break;
+            case LAYOUT_IMM:
+                emitByte16(assembler, instruction->value);
+                break;
+            case LAYOUT_ADDR:
+                if(instruction->label != NULL) emitLabel(assembler, instruction->label);
+                else if(instruction->string != NULL) emitPoolString(assembler, instruction->string);
+                else emitByte16(assembler, instruction->value);
+                break;
+            case LAYOUT_REG_ADDR:
+                emitByte(assembler, instruction->reg1);
+                if(instruction->label != NULL) emitLabel(assembler, instruction->label);
+                else emitByte16(assembler, instruction->value);
+                break;
+            case LAYOUT_REG_REG_ADDR:
+                emitByte(assembler, instruction->reg1);
+                emitByte(assembler, instruction->reg2);
+                if(instruction->label != NULL) emitLabel(assembler, instruction->label);
+                else emitByte16(assembler, instruction->value);
+                break;
+            case LAYOUT_REG_IMM_ADDR:
+                emitByte(assembler, instruction->reg1);
+                emitByte16(assembler, instruction->immediate);
+                if(instruction->label != NULL) emitLabel(assembler, instruction->label);
+                else emitByte16(assembler, instruction->value);
+                break;
+            case LAYOUT_STRING:
+                emitBytes(assembler, (const uint8_t*)instruction->string->chars, instruction->string->length);
+                emitByte(assembler, 0x00); // null terminate string
+                break;
+            case LAYOUT_HOST:
+                emitByte(assembler, (uint8_t)instruction->value);
+                break;
+            case LAYOUT_REL:
+            case LAYOUT_REG_REL:
+            case LAYOUT_POOL:
+                break;
+        }
+    }
+
+    for(int i = 0; i < assembler->labels.capacity; i++) {
+        Entry* entry = &assembler->labels.entries[i];
+        if(entry->key != NULL && entry->defined)
+            entry->value = addresses[entry->value];
+    }
 
-    memmove(s, p, l + 1);
+    free(addresses);
 }
 
-char** split(char* str, char* delim) {
-    char** res = NULL;
-    char* p = strtok(str, delim);
-    int nspaces = 0, i;
+// every label reference becomes a relocation, the linker resolves them once
+// the final position of each object is known. strings are interned, so a
+// literal printed in many places is one entry.
+static void buildObject(Assembler* assembler, const char* path, Object* object) {
+    object->path = path;
+    object->codeSize = assembler->count;
+    object->symbolCount = 0;
+    object->symbols = malloc(sizeof(ObjectSymbol) * (assembler->labels.count + 1));
+    object->relocationCount = 0;
+    object->stringCount = 0;
+    object->stringRelocationCount = 0;
+    object->files = assembler->files;
+    object->fileCount = assembler->fileCount;
+    object->lines = assembler->lines;
+    object->lineCount = assembler->lineCount;
+    object->relocations = malloc(sizeof(Relocation) * (assembler->fixupCount + 1));
+    object->strings = malloc(sizeof(PoolString) * (assembler->fixupCount + 1));
+    object->stringRelocations = malloc(sizeof(Relocation) * (assembler->fixupCount + 1));
+    if(object->symbols == NULL || object->relocations == NULL || object->strings == NULL ||
+            object->stringRelocations == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
 
-    while(p) {
-        res = realloc(res, sizeof(char*) * ++nspaces);
+    Table indices;
+    initTable(&indices);
+    for(int i = 0; i < assembler->labels.capacity; i++) {
+        Entry* entry = &assembler->labels.entries[i];
+        if(entry->key == NULL) continue;
+
+        ObjectSymbol* symbol = &object->symbols[object->symbolCount];
+        symbol->name = entry->key->chars;
+        symbol->length = entry->key->length;
+        symbol->value = entry->value;
+        symbol->flags = entry->defined ? SYMBOL_DEFINED : 0;
+        tableSet(&indices, entry->key, object->symbolCount++);
+    }
 
-        if(res == NULL) {
-            fprintf(stderr, "out of memory.\n");
-            exit(1);
+    Table strings;
+    initTable(&strings);
+    for(int i = 0; i < assembler->fixupCount; i++) {
+        Fixup* fixup = &assembler->fixups[i];
+        if(!fixup->string) {
+            Relocation* relocation = &object->relocations[object->relocationCount++];
+            relocation->offset = fixup->offset;
+            relocation->symbol = tableGet(&indices, fixup->label)->value;
+            continue;
         }
 
-        res[nspaces-1] = p;
+        Entry* entry = tableGet(&strings, fixup->label);
+        if(entry == NULL) {
+            object->strings[object->stringCount].chars = fixup->label->chars;
+            object->strings[object->stringCount].length = fixup->label->length;
+            entry = tableSet(&strings, fixup->label, object->stringCount++);
+        }
+        Relocation* relocation = &object->stringRelocations[object->stringRelocationCount++];
+        relocation->offset = fixup->offset;
+        relocation->symbol = entry->value;
+    }
+
+    freeTable(&strings);
+    freeTable(&indices);
+
+    // copy the names and strings behind the code, so the object keeps nothing
+    // of the unit's symbols and they can be freed with the assembler
+    size_t size = assembler->count;
+    for(uint32_t i = 0; i < object->symbolCount; i++) size += object->symbols[i].length;
+    for(uint32_t i = 0; i < object->stringCount; i++) size += object->strings[i].length;
+    uint8_t* storage = realloc(assembler->buffer, size + 1);
+    if(storage == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    size_t offset = assembler->count;
+    for(uint32_t i = 0; i < object->symbolCount; i++) {
+        memcpy(storage + offset, object->symbols[i].name, object->symbols[i].length);
+        object->symbols[i].name = (const char*)storage + offset;
+        offset += object->symbols[i].length;
+    }
+    for(uint32_t i = 0; i < object->stringCount; i++) {
+        memcpy(storage + offset, object->strings[i].chars, object->strings[i].length);
+        object->strings[i].chars = (const char*)storage + offset;
+        offset += object->strings[i].length;
+    }
+    assembler->buffer = NULL;
+    object->storage = storage;
+    object->code = storage;
+}
 
-        p = strtok(NULL, delim);
+static void errorAt(Parser* parser, Token* token, const char* format, ...) {
+    fprintf(stderr, "%s:%d: ", parser->path, token->line);
+    if(token->type == TOKEN_ERROR) {
+        fprintf(stderr, "%.*s.\n", token->length, token->start);
+        exit(1);
     }
 
-    res = realloc(res, sizeof(char*) * (nspaces+1));
-    res[nspaces] = 0;
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, ".\n");
+    exit(1);
+}
 
-    return res;
+static Token advance(Parser* parser) {
+    Token token = scanToken(&parser->lexer);
+    if(token.type == TOKEN_ERROR) errorAt(parser, &token, NULL);
+    return token;
 }
 
-static uint8_t getRegisterHex(const char* reg) {
-    switch(hashString(reg)) {
-        case HR_R0: return r0;
-        case HR_R1: return r1;
-        case HR_R2: return r2;
-        case HR_R3: return r3;
-        case HR_R4: return r4;
-        case HR_R5: return r5;
-        case HR_R6: return r6;
-        case HR_R7: return r7;
-        case HR_R8: return r8;
-        case HR_R9: return r9;
-        case HR_R10: return r10;
-        case HR_AX: return ax;
-        case HR_BX: return bx;
-        case HR_CX: return cx;
-        case HR_DX: return dx;
-        default: {
-            fprintf(stderr, "invalid register `%s`.\n", reg);
-            exit(1);
-        }
+static void expectLineEnd(Parser* parser) {
+    Token token = advance(parser);
+    if(token.type != TOKEN_NEWLINE && token.type != TOKEN_EOF)
+        errorAt(parser, &token, "unexpected operand `%.*s`", token.length, token.start);
+}
+
+static uint8_t getRegister(Parser* parser) {
+    Token token = advance(parser);
+    if(token.type == TOKEN_WORD) {
+        int reg = lookupRegister(token.start, token.length, token.hash);
+        if(reg >= 0) return (uint8_t)reg;
     }
+
+    errorAt(parser, &token, "invalid register `%.*s`", token.length, token.start);
     return 0x00;
 }
 
-static void matchArgs(char** args, int expected) {
-    size_t num = (sizeof(args) / sizeof(args[0])) + 1;
-    if(num < expected) {
-        fprintf(stderr, "argument mismatch for instruction `%s`.\n", args[0]);
-        exit(1);
+// numbers follow strtol base 0 rules: 0x for hexadecimal, leading 0 for octal
+static bool parseNumber(const char* start, int length, uint16_t* value) {
+    int base = 10;
+    int i = 0;
+    if(length > 2 && start[0] == '0' && (start[1] == 'x' || start[1] == 'X')) {
+        base = 16;
+        i = 2;
+    } else if(length > 1 && start[0] == '0') {
+        base = 8;
+        i = 1;
+    }
+
+    uint32_t result = 0;
+    for(; i < length; i++) {
+        char c = start[i];
+        int digit;
+        if(c >= '0' && c <= '9') digit = c - '0';
+        else if(c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else return false;
+        if(digit >= base) return false;
+        result = result * base + digit;
     }
+
+    *value = (uint16_t)result;
+    return true;
 }
 
-static bool startsWith(const char *pre, const char *str) {
-    size_t lenpre = strlen(pre), lenstr = strlen(str);
-    return lenstr < lenpre ? false : memcmp(pre, str, lenpre) == 0;
+static uint16_t getNumber(Parser* parser) {
+    Token token = advance(parser);
+    uint16_t value;
+    if(token.type != TOKEN_NUMBER || !parseNumber(token.start, token.length, &value))
+        errorAt(parser, &token, "invalid number `%.*s`", token.length, token.start);
+    return value;
 }
 
-static bool match(const char* line, char chr, int index) {
-    return line[index] == chr;
+static uint8_t getHostFunction(Parser* parser) {
+    Token token = advance(parser);
+    if(token.type == TOKEN_WORD) {
+        for(int i = 0; i < HOST_BUILTIN_COUNT; i++) {
+            if((int)strlen(hostFunctionNames[i]) == token.length &&
+                    memcmp(hostFunctionNames[i], token.start, token.length) == 0)
+                return (uint8_t)i;
+        }
+    } else if(token.type == TOKEN_NUMBER) {
+        uint16_t index;
+        if(parseNumber(token.start, token.length, &index) && index < HOST_MAX) return (uint8_t)index;
+    }
+
+    errorAt(parser, &token, "unknown host function `%.*s`", token.length, token.start);
+    return 0x00;
 }
 
 static bool isAlpha(char c)
@@ -187,419 +456,369 @@ static bool isAlpha(char c)
            c == '_';
 }
 
-char* matchLabel(char* line) {
-    int length = (int)strlen(line);
-    if(length < 2) return NULL;
-    char name[length];
-    int k = 0;
-    for(int i = 0; i < length; i++) {
-        if(isAlpha(line[i]) != 1) break;
-        //printf("%c", line[i]);
-        name[i] = line[i];
-        k++;
-    }
-    if(line[k] == ':') {
-        name[k] = '\0';
-        return strdup(name);
-    }
-    return NULL;
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
 }
 
-static bool isAlphaStr(char* line) {
-    for(int i = 0; i < strlen(line); i++) {
-        if(isAlpha(line[i]) != 1) return false;
+static bool isIdentifier(const char* start, int length) {
+    if(!isAlpha(start[0])) return false;
+    for(int i = 1; i < length; i++) {
+        if(!isAlpha(start[i]) && !isDigit(start[i])) return false;
     }
     return true;
 }
 
-static bool file_exists(char *filename) {
-    struct stat buffer;   
-    return (stat(filename, &buffer) == 0);
+// a jump target is either a number or a label, labels are resolved at link time
+static void getAddress(Parser* parser, Instruction* instruction) {
+    Assembler* assembler = parser->assembler;
+    Token token = advance(parser);
+    if(token.type == TOKEN_NUMBER) {
+        if(!parseNumber(token.start, token.length, &instruction->value))
+            errorAt(parser, &token, "invalid number `%.*s`", token.length, token.start);
+        return;
+    }
+
+    if(token.type != TOKEN_WORD || !isIdentifier(token.start, token.length))
+        errorAt(parser, &token, "invalid label `%.*s`", token.length, token.start);
+
+    Symbol* label = internSymbol(&assembler->strings, token.start, token.length, token.hash);
+    if(tableGet(&assembler->labels, label) == NULL)
+        tableSet(&assembler->labels, label, 0);
+    instruction->label = label;
+}
+
+// labels point at the index of the instruction that follows them
+static void defineLabel(Parser* parser, Token* token) {
+    Assembler* assembler = parser->assembler;
+    if(!isIdentifier(token->start, token->length))
+        errorAt(parser, token, "invalid label `%.*s`", token->length, token->start);
+
+    Symbol* symbol = internSymbol(&assembler->strings, token->start, token->length, token->hash);
+    Entry* entry = tableGet(&assembler->labels, symbol);
+    if(entry != NULL && entry->defined)
+        errorAt(parser, token, "label `%s` already defined", symbol->chars);
+
+    entry = tableSet(&assembler->labels, symbol, (uint32_t)assembler->instructionCount);
+    entry->defined = true;
 }
 
-void assembleFile(FILE* file) {
-    char* line = NULL;
-    char** splitline = NULL;
-    size_t len = 0;
-    ssize_t read;
+static void includeFile(Parser* parser) {
+    Token token = advance(parser);
+    if(token.type != TOKEN_WORD && token.type != TOKEN_STRING)
+        errorAt(parser, &token, "expected file to include");
+    if(token.length >= PATH_MAX)
+        errorAt(parser, &token, "include path too long");
+
+    char path[PATH_MAX];
+    memcpy(path, token.start, token.length);
+    path[token.length] = '\0';
 
-    while((read = getline(&line, &len, file)) != -1) {
-        line[strcspn(line, "\n")] = 0; // remove trailing newline
-        trim(line);
-        splitline = split(line, ", ");
+    expectLineEnd(parser);
+    assembleFile(parser->assembler, path);
+}
 
-        if(strcmp(line, "") == 0) continue; // empty line
-        if(startsWith(";", line)) continue; // single line comment
-        char* label = matchLabel(splitline[0]);
-        if(label != NULL) {
-            insertKey(label, assembler.bytesWritten, labelArray);
-            continue; // label
+static uint32_t addFile(Assembler* assembler, const char* path) {
+    if(assembler->fileCapacity < assembler->fileCount + 1) {
+        assembler->fileCapacity = GROW_CAPACITY(assembler->fileCapacity);
+        assembler->files = realloc(assembler->files, sizeof(const char*) * assembler->fileCapacity);
+        if(assembler->hashFiles)
+            assembler->fileHashes = realloc(assembler->fileHashes, sizeof(CacheHash) * assembler->fileCapacity);
+        if(assembler->files == NULL || (assembler->hashFiles && assembler->fileHashes == NULL)) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
         }
-        if(strcmp("\%include", splitline[0]) == 0) {
-            matchArgs(splitline, 1);
-            if(!file_exists(splitline[1])) {
-                fprintf(stderr, "attempted to include a file `%s` that does not exist.\n", splitline[1]);
-                exit(1);
-            }
-            FILE* ftemp = fopen(splitline[1], "r");
-            assembleFile(ftemp);
-            continue;
+    }
+
+    // include paths live on the stack of the including parser
+    char* copy = strdup(path);
+    if(copy == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    assembler->files[assembler->fileCount] = copy;
+    return (uint32_t)assembler->fileCount++;
+}
+
+void assembleFile(Assembler* assembler, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "attempted to include a file `%s` that does not exist.\n", path);
+        exit(1);
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        fprintf(stderr, "error reading file `%s`.\n", path);
+        exit(1);
+    }
+
+    const char* source = NULL;
+    size_t length = (size_t)st.st_size;
+    if(length > 0) {
+        source = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(source == MAP_FAILED) {
+            fprintf(stderr, "error mapping file `%s`.\n", path);
+            exit(1);
         }
+        madvise((void*)source, length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    Parser parser;
+    parser.assembler = assembler;
+    parser.path = path;
+    parser.file = addFile(assembler, path);
+    if(assembler->hashFiles)
+        assembler->fileHashes[parser.file] = hashContent(source, length);
+    initLexer(&parser.lexer, source, length);
+    parseSource(&parser);
+
+    if(source != NULL)
+        munmap((void*)source, length);
+}
 
-        switch(hashString(splitline[0])) {
-            case H_HALT: {
-                emitByte(OP_HALT);
-                break;
-            }
-            case H_MOV: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_MOV);
-                emitByte(reg1);
-                emitByte(reg2);
-                break;
-            }
-            case H_PRINTC: {
-                matchArgs(splitline, 1);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                emitByte(OP_PRINTC);
-                emitByte(reg);
-                break;
-            }
-            case H_PRINTCS: {
-                matchArgs(splitline, 1);
-                size_t index = strlen(splitline[0]) + 1;
-                char lastChar;
-                if(line[index] == '\"') index++;
-                emitByte(OP_PRINTCS);
-                for(;;) {
-                    lastChar = line[index++];
-                    if(lastChar == '\n') {
-                        fprintf(stderr, "unterminated string.\n");
-                        exit(1);
-                    }
-                    if(lastChar == '\"') break;
-                    if(lastChar == 0x00) emitByte((uint16_t)0x20);
-                    else emitByte((uint8_t)lastChar);
-                }
-                emitByte(0x00); // null terminate string
-                break;
-            }
-            case H_PRINTI: {
-                matchArgs(splitline, 1);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                emitByte(OP_PRINTI);
-                emitByte(reg);
-                break;
-            }
-            case H_PRINTH: {
-                matchArgs(splitline, 1);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                emitByte(OP_PRINTH);
-                emitByte(reg);
-                break;
-            }
-            case H_SETR: {
-                matchArgs(splitline, 2);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                uint16_t value = (uint16_t)strtol(splitline[2], NULL, 0);
-                emitByte(OP_SETR);
-                emitByte(reg);
-                emitByte16(value);
-                break;
-            }
-            case H_INC: {
-                matchArgs(splitline, 1);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                emitByte(OP_INC);
-                emitByte(reg);
-                break;
-            }
-            case H_DEC: {
-                matchArgs(splitline, 1);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                emitByte(OP_DEC);
-                emitByte(reg);
-                break;
-            }
-            case H_ADD: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_ADD);
-                emitByte(reg1);
-                emitByte(reg2);
-                break;
-            }
-            case H_SUB: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_SUB);
-                emitByte(reg1);
-                emitByte(reg2);
-                break;
-            }
-            case H_MUL: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_MUL);
-                emitByte(reg1);
-                emitByte(reg2);
-                break;
-            }
-            case H_DIV: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_DIV);
-                emitByte(reg1);
-                emitByte(reg2);
-                break;
-            }
-            case H_JMP: {
-                matchArgs(splitline, 1);
-                uint16_t dest;
-                if(!isAlphaStr(splitline[1]))
-                    dest = (uint16_t)strtol(splitline[1], NULL, 0);
-                else {
-                    if(searchKey(splitline[1], labelArray) != NULL)
-                        dest = searchKey(splitline[1], labelArray)->value;
-                    else {
-                        fprintf(stderr, "label `%s` does not exist.\n", splitline[1]);
-                        exit(1);
-                    }
-                }
-
-                emitByte(OP_JMP);
-                emitByte16(dest);
-                break;
-            }
-            case H_JNZ: {
-                matchArgs(splitline, 2);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                uint16_t dest;
-                if(!isAlphaStr(splitline[2]))
-                    dest = (uint16_t)strtol(splitline[2], NULL, 0);
-                else {
-                    if(searchKey(splitline[2], labelArray) != NULL)
-                        dest = searchKey(splitline[2], labelArray)->value;
-                    else {
-                        fprintf(stderr, "label `%s` does not exist.\n", splitline[2]);
-                        exit(1);
-                    }
-                }
-                emitByte(OP_JNZ);
-                emitByte(reg);
-                emitByte16(dest);
-                break;
-            }
-            case H_JZ: {
-                matchArgs(splitline, 2);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                uint16_t dest;
-                if(isAlphaStr(splitline[2]) != 1)
-                    dest = (uint16_t)strtol(splitline[2], NULL, 0);
-                else {
-                    if(searchKey(splitline[2], labelArray) != NULL)
-                        dest = searchKey(splitline[1], labelArray)->value;
-                    else {
-                        fprintf(stderr, "label `%s` does not exist.\n", splitline[2]);
-                        exit(1);
-                    }
-                }
-                emitByte(OP_JZ);
-                emitByte(reg);
-                emitByte16(dest);
-                break;
-            }
-            case H_SHL: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_SHL);
-                emitByte(reg1);
-                emitByte(reg2);
-                break;
-            }
-            case H_SHR: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_SHR);
-                emitByte(reg1);
-                emitByte(reg2);
-                break;
-            }
-            case H_XOR: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_XOR);
-                emitByte(reg1);
-                emitByte(reg2);
-                break;
-            }
-            case H_OR: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_OR);
-                emitByte(reg1);
-                emitByte(reg2);
-                break;
-            }
-            case H_AND: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_AND);
-                emitByte(reg1);
-                emitByte(reg2);
-                break;
-            }
-            case H_POP: {
-                matchArgs(splitline, 1);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                emitByte(OP_POP);
-                emitByte(reg);
-                break;
-            }
-            case H_PUSH: {
-                matchArgs(splitline, 1);
-                uint16_t data = (uint16_t)strtol(splitline[1], NULL, 0);
-                emitByte(OP_PUSH);
-                emitByte16(data);
-                break;
+static void parseSource(Parser* parser) {
+    Assembler* assembler = parser->assembler;
+    for(;;) {
+        Token token = advance(parser);
+        if(token.type == TOKEN_EOF) break;
+        if(token.type == TOKEN_NEWLINE) continue; // empty line
+        if(token.type == TOKEN_LABEL) {
+            defineLabel(parser, &token);
+            continue; // label, may be followed by an instruction
+        }
+        if(token.type == TOKEN_DIRECTIVE) {
+            if(token.length == 8 && memcmp(token.start, "%include", 8) == 0) {
+                includeFile(parser);
+                continue;
             }
-            case H_PUSHR: {
-                matchArgs(splitline, 1);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                emitByte(OP_PUSHR);
-                emitByte(reg);
+            errorAt(parser, &token, "unknown directive `%.*s`", token.length, token.start);
+        }
+        if(token.type != TOKEN_WORD)
+            errorAt(parser, &token, "expected instruction, got `%.*s`", token.length, token.start);
+
+        uint8_t opcode;
+        const InstructionInfo* info = lookupInstruction(token.start, token.length, token.hash, &opcode);
+        if(info == NULL)
+            errorAt(parser, &token, "invalid instruction `%.*s`", token.length, token.start);
+
+        // short branches are picked by relaxation, an explicit one is only a hint
+        opcode = longBranch(opcode);
+        info = &instructionInfo[opcode];
+
+        Instruction* instruction = addInstruction(assembler, opcode);
+        instruction->file = parser->file;
+        instruction->line = token.line;
+        switch(info->layout) {
+            case LAYOUT_NONE:
                 break;
-            }
-            case H_GETIP: {
-                matchArgs(splitline, 1);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                emitByte(OP_GETIP);
-                emitByte(reg);
+            case LAYOUT_REG:
+                instruction->reg1 = getRegister(parser);
                 break;
-            }
-            case H_PEEK: {
-                matchArgs(splitline, 1);
-                uint8_t reg = getRegisterHex(splitline[1]);
-                emitByte(OP_PEEK);
-                emitByte(reg);
+            case LAYOUT_REG_REG:
+                instruction->reg1 = getRegister(parser);
+                instruction->reg2 = getRegister(parser);
                 break;
-            }
-            case H_MOD: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_MOD);
-                emitByte(reg1);
-                emitByte(reg2);
+            case LAYOUT_REG_IMM:
+                instruction->reg1 = getRegister(parser);
+                instruction->value = getNumber(parser);
                 break;
-            }
-            case H_LT: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_LT);
-                emitByte(reg1);
-                emitByte(reg2);
+            case LAYOUT_IMM:
+                instruction->value = getNumber(parser);
                 break;
-            }
-            case H_GT: {
-                matchArgs(splitline, 2);
-                uint8_t reg1 = getRegisterHex(splitline[1]);
-                uint8_t reg2 = getRegisterHex(splitline[2]);
-                emitByte(OP_GT);
-                emitByte(reg1);
-                emitByte(reg2);
+            case LAYOUT_ADDR:
+                getAddress(parser, instruction);
                 break;
-            }
-            case H_RET: {
-                matchArgs(splitline, 0);
-                emitByte(OP_RET);
+            case LAYOUT_REG_ADDR:
+                instruction->reg1 = getRegister(parser);
+                getAddress(parser, instruction);
                 break;
-            }
-            case H_CALL: {
-                matchArgs(splitline, 1);
-                uint16_t dest;
-                if(isAlphaStr(splitline[1]) != 1) {
-                    dest = (uint16_t)strtol(splitline[1], NULL, 0);
-                } else {
-                    if(searchKey(splitline[1], labelArray) != NULL) {
-                        dest = searchKey(splitline[1], labelArray)->value;
-                    } else {
-                        fprintf(stderr, "label `%s` does not exist.\n", splitline[1]);
-                        exit(1);
-                    }
-                }
-                emitByte(OP_CALL);
-                emitByte16(dest);
+            case LAYOUT_REG_REG_ADDR:
+                instruction->reg1 = getRegister(parser);
+                instruction->reg2 = getRegister(parser);
+                getAddress(parser, instruction);
                 break;
-            }
-            case H_PRINTIS: {
-                matchArgs(splitline, 0);
-                emitByte(OP_PRINTIS);
+            case LAYOUT_REG_IMM_ADDR:
+                instruction->reg1 = getRegister(parser);
+                instruction->immediate = getNumber(parser);
+                getAddress(parser, instruction);
                 break;
-            }
-            case H_ADDS: {
-                matchArgs(splitline, 0);
-                emitByte(OP_ADDS);
+            case LAYOUT_STRING: {
+                Token string = advance(parser);
+                if(string.type != TOKEN_STRING) errorAt(parser, &string, "expected string");
+                instruction->string = internSymbol(&assembler->strings, string.start, string.length,
+                    hashString(string.start, string.length));
                 break;
             }
-            case H_SUBS: {
-                matchArgs(splitline, 0);
-                emitByte(OP_SUBS);
+            case LAYOUT_HOST:
+                instruction->value = getHostFunction(parser);
                 break;
-            }
-            case H_MULS: {
-                matchArgs(splitline, 0);
-                emitByte(OP_MULS);
-                break;
-            }
-            case H_DIVS: {
-                matchArgs(splitline, 0);
-                emitByte(OP_DIVS);
+            case LAYOUT_POOL:
+                errorAt(parser, &token, "the string pool is placed by the linker");
                 break;
-            }
-            case H_GTS: {
-                matchArgs(splitline, 0);
-                emitByte(OP_GTS);
+            case LAYOUT_REL:
+            case LAYOUT_REG_REL:
+                // unreachable, longBranch above turned a short form into its long one
                 break;
-            }
-            case H_LTS: {
-                matchArgs(splitline, 0);
-                emitByte(OP_LTS);
-                break;
-            }
-            default: {
-                fprintf(stderr, "invalid instruction `%s`.\n", splitline[0]);
-                exit(1);
-            }
         }
-    }
 
-    fclose(file);
-    if(line)
-        free(line);
+        expectLineEnd(parser);
+    }
 }
 
-void assemble(FILE* file, char* outf) {
-    assembler.bytesWritten = 0x03;
+void assembleObject(const char* path, Object* object, AssemblerOptions* options, CacheHash* entry) {
+    if(options->cache != NULL && loadCachedUnit(options->cache, path, options, object, entry))
+        return;
+
+    Assembler assembler;
+    assembler.instructionCount = 0;
+    assembler.instructionCapacity = 0;
+    assembler.instructions = NULL;
+    assembler.fileCount = 0;
+    assembler.fileCapacity = 0;
+    assembler.files = NULL;
+    assembler.hashFiles = options->cache != NULL;
+    assembler.fileHashes = NULL;
+    assembler.lineCount = 0;
+    assembler.lineCapacity = 0;
+    assembler.lines = NULL;
     assembler.count = 0;
-    assembler.capacity = 8;
-    assembler.buffer = malloc(sizeof(uint8_t) * assembler.capacity);
+    assembler.capacity = 0;
+    assembler.buffer = NULL;
+    assembler.fixupCount = 0;
+    assembler.fixupCapacity = 0;
+    assembler.fixups = NULL;
+    initTable(&assembler.labels);
+    initTable(&assembler.strings);
+
+    assembleFile(&assembler, path);
+    if(options->optimize)
+        optimizeInstructions(&assembler, path);
+    encodeInstructions(&assembler, options->debug);
+    buildObject(&assembler, path, object);
+    if(options->cache != NULL)
+        *entry = storeCachedUnit(options->cache, path, options, object, assembler.fileHashes);
+
+    free(assembler.fileHashes);
+    free(assembler.instructions);
+    free(assembler.fixups);
+    freeTable(&assembler.labels);
+    freeSymbols(&assembler.strings);
+}
 
-    assembleFile(file);
-    padJumpToMain();
+// `input.sasm` becomes `input.o`
+static char* objectName(const char* input) {
+    const char* dot = strrchr(input, '.');
+    const char* slash = strrchr(input, '/');
+    size_t length = (dot != NULL && (slash == NULL || dot > slash)) ? (size_t)(dot - input) : strlen(input);
 
-    FILE* out = fopen(outf, "wb");
-    writeBuffer(out);
-}
\ No newline at end of file
+    char* name = malloc(length + 3);
+    memcpy(name, input, length);
+    memcpy(name + length, ".o", 3);
+    return name;
+}
+
+typedef struct {
+    const char** inputs;
+    AssemblerOptions* options;
+    Object* objects;
+    CacheHash* entries;         // each unit's cache entry when caching
+    int count;
+    atomic_int next;
+} Batch;
+
+// workers pull the next unassembled unit until none are left, every unit
+// has its own assembler state so nothing is shared but the counter
+static void* assembleWorker(void* arg) {
+    Batch* batch = (Batch*)arg;
+    for(;;) {
+        int index = atomic_fetch_add(&batch->next, 1);
+        if(index >= batch->count) break;
+        assembleObject(batch->inputs[index], &batch->objects[index], batch->options, &batch->entries[index]);
+    }
+    return NULL;
+}
+
+static void assembleAll(const char** inputs, Object* objects, CacheHash* entries, int count, AssemblerOptions* options) {
+    int jobs = options->jobs;
+    Batch batch;
+    batch.inputs = inputs;
+    batch.options = options;
+    batch.objects = objects;
+    batch.entries = entries;
+    batch.count = count;
+    atomic_init(&batch.next, 0);
+
+    if(jobs > count) jobs = count;
+    if(jobs <= 1) {
+        assembleWorker(&batch);
+        return;
+    }
+
+    pthread_t* threads = malloc(sizeof(pthread_t) * jobs);
+    if(threads == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    for(int i = 0; i < jobs; i++) {
+        if(pthread_create(&threads[i], NULL, assembleWorker, &batch) != 0) {
+            fprintf(stderr, "error starting assembler thread.\n");
+            exit(1);
+        }
+    }
+    for(int i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+}
+
+// units are assembled in any order but always linked in the order given,
+// so the image does not depend on the number of jobs
+void assemble(const char** inputs, int count, const char* outf, AssemblerOptions* options) {
+    if(options->cache != NULL && !options->object && loadCachedImage(options->cache, inputs, count, options, outf))
+        return;
+
+    Object* objects = malloc(sizeof(Object) * count);
+    CacheHash* entries = malloc(sizeof(CacheHash) * count);
+    if(objects == NULL || entries == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    initInstructionSet();
+    assembleAll(inputs, objects, entries, count, options);
+
+    if(options->object) {
+        for(int i = 0; i < count; i++) {
+            char* name = outf != NULL ? NULL : objectName(inputs[i]);
+            writeObject(outf != NULL ? outf : name, &objects[i]);
+            freeObject(&objects[i]);
+            free(name);
+        }
+        free(objects);
+        free(entries);
+        return;
+    }
+
+    Image image;
+    linkObjects(objects, count, &image);
+    writeImage(outf, &image);
+
+    if(options->debug) {
+        char path[PATH_MAX];
+        if(snprintf(path, sizeof(path), "%s.sdbg", outf) >= (int)sizeof(path)) {
+            fprintf(stderr, "output path `%s` is too long.\n", outf);
+            exit(1);
+        }
+        writeDebugInfo(path, &image);
+    }
+    if(options->cache != NULL)
+        storeCachedImage(options->cache, entries, count, options, outf);
+
+    for(int i = 0; i < count; i++)
+        freeObject(&objects[i]);
+    free(image.pool);
+    free(objects);
+    free(entries);
+}
@@ -0,0 +1,381 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "host.h"
+#include "vm.h"
+
+#ifndef SYNAS_VERSION
+#define SYNAS_VERSION "nut"
+#endif
+
+#define CACHE_FORMAT "synas cache 1"
+
+#define FNV128_OFFSET (((CacheHash)0x6c62272e07bb0142ull << 64) | 0x62b821756295c58dull)
+
+// the prime is 2^88 + 0x13b, so the multiply is a shift and a small multiply
+static CacheHash hashBytes(CacheHash hash, const void* data, size_t length) {
+    const uint8_t* bytes = data;
+    for(size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash = (hash << 88) + hash * 0x13b;
+    }
+    return hash;
+}
+
+// strings are hashed with their terminator so "ab" "c" and "a" "bc" differ
+static CacheHash hashName(CacheHash hash, const char* name) {
+    return hashBytes(hash, name, strlen(name) + 1);
+}
+
+static CacheHash hashValue(CacheHash hash, CacheHash value) {
+    return hashBytes(hash, &value, sizeof(value));
+}
+
+CacheHash hashContent(const void* data, size_t length) {
+    return hashBytes(FNV128_OFFSET, data, length);
+}
+
+// anything that can change the object for the same source: the version only
+// moves on releases, so the opcode, register and host tables are hashed too
+static CacheHash unitKey(const char* path, AssemblerOptions* options, CacheHash source) {
+    CacheHash hash = hashName(FNV128_OFFSET, CACHE_FORMAT);
+    hash = hashName(hash, SYNAS_VERSION);
+    for(int opcode = 0; opcode < 256; opcode++) {
+        const InstructionInfo* info = &instructionInfo[opcode];
+        if(info->mnemonic == NULL) continue;
+        uint8_t row[3] = { (uint8_t)opcode, (uint8_t)info->layout, (uint8_t)info->flow };
+        hash = hashBytes(hash, row, sizeof(row));
+        hash = hashName(hash, info->mnemonic);
+    }
+    for(int reg = 0; reg < NUM_REGS; reg++)
+        hash = hashName(hash, registerNames[reg]);
+    for(int index = 0; index < HOST_BUILTIN_COUNT; index++)
+        hash = hashName(hash, hostFunctionNames[index]);
+    uint8_t flags[2] = { options->optimize, options->debug };
+    hash = hashBytes(hash, flags, sizeof(flags));
+    hash = hashName(hash, path);
+    return hashValue(hash, source);
+}
+
+static void hashText(CacheHash hash, char* text) {
+    static const char digits[] = "0123456789abcdef";
+    for(int i = 31; i >= 0; i--) {
+        text[i] = digits[(int)(hash & 0x0F)];
+        hash >>= 4;
+    }
+    text[32] = '\0';
+}
+
+static bool cachePath(char* buffer, const char* cache, CacheHash hash, const char* suffix) {
+    char name[33];
+    hashText(hash, name);
+    return snprintf(buffer, PATH_MAX, "%s/%s%s", cache, name, suffix) < PATH_MAX;
+}
+
+// the whole file with a terminator after it, NULL when it can't be read
+static uint8_t* readWhole(const char* path, size_t* length) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t* buffer = malloc((size_t)st.st_size + 1);
+    size_t done = 0;
+    while(buffer != NULL && done < (size_t)st.st_size) {
+        ssize_t got = read(fd, buffer + done, (size_t)st.st_size - done);
+        if(got <= 0) {
+            free(buffer);
+            buffer = NULL;
+            break;
+        }
+        done += (size_t)got;
+    }
+    close(fd);
+    if(buffer == NULL) return NULL;
+    buffer[done] = '\0';
+    *length = done;
+    return buffer;
+}
+
+static bool hashFile(const char* path, CacheHash* hash) {
+    size_t length;
+    uint8_t* bytes = readWhole(path, &length);
+    if(bytes == NULL) return false;
+    *hash = hashContent(bytes, length);
+    free(bytes);
+    return true;
+}
+
+// a cache that can't be written to only costs the build its speedup
+static void writeAtomically(const char* cache, const char* path, const uint8_t* data, size_t length) {
+    mkdir(cache, 0777);
+
+    char temporary[PATH_MAX];
+    if(snprintf(temporary, sizeof(temporary), "%s.%d.%lx.tmp", path, (int)getpid(),
+            (unsigned long)pthread_self()) >= (int)sizeof(temporary))
+        return;
+
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return;
+    size_t done = 0;
+    while(done < length) {
+        ssize_t written = write(fd, data + done, length - done);
+        if(written < 0 && errno == EINTR) continue;
+        if(written <= 0) break;
+        done += (size_t)written;
+    }
+    if(close(fd) < 0 || done < length || rename(temporary, path) < 0)
+        unlink(temporary);
+}
+
+static CacheHash entryKey(CacheHash key, const char* path, CacheHash content) {
+    return hashValue(hashName(key, path), content);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+    return p + 4;
+}
+
+// the file list and line table follow the object bytes
+static bool decodeUnit(uint8_t* buffer, size_t length, Object* object) {
+    size_t used;
+    if(decodeObject(buffer, length, object, &used) != NULL) return false;
+
+    uint8_t* p = buffer + used;
+    uint8_t* end = buffer + length;
+    if(end - p < 4) return false;
+    object->fileCount = get32(p);
+    p += 4;
+    object->files = malloc(sizeof(const char*) * (object->fileCount + 1));
+    if(object->files == NULL) return false;
+    for(uint32_t i = 0; i < object->fileCount; i++) {
+        if(end - p < 2) return false;
+        size_t nameLength = (size_t)((p[0] << 8) | p[1]);
+        p += 2;
+        if((size_t)(end - p) < nameLength) return false;
+        char* name = malloc(nameLength + 1);
+        if(name == NULL) return false;
+        memcpy(name, p, nameLength);
+        name[nameLength] = '\0';
+        object->files[i] = name;
+        p += nameLength;
+    }
+
+    if(end - p < 4) return false;
+    object->lineCount = get32(p);
+    p += 4;
+    if((size_t)(end - p) / 12 < object->lineCount) return false;
+    object->lines = malloc(sizeof(SourceLine) * (object->lineCount + 1));
+    if(object->lines == NULL) return false;
+    for(uint32_t i = 0; i < object->lineCount; i++) {
+        object->lines[i].offset = get32(p);
+        object->lines[i].file = get32(p + 4);
+        object->lines[i].line = get32(p + 8);
+        p += 12;
+    }
+    return p == end;
+}
+
+static bool findEntry(const char* cache, const char* path, AssemblerOptions* options, CacheHash* entry) {
+    CacheHash source;
+    if(!hashFile(path, &source)) return false;
+    CacheHash key = unitKey(path, options, source);
+
+    char manifestPath[PATH_MAX];
+    if(!cachePath(manifestPath, cache, key, ".manifest")) return false;
+    size_t manifestLength;
+    char* manifest = (char*)readWhole(manifestPath, &manifestLength);
+    if(manifest == NULL) return false;
+
+    // an include that changed or disappeared leads to an entry that isn't there
+    *entry = key;
+    bool found = true;
+    for(char* line = manifest; found && *line != '\0';) {
+        char* newline = strchr(line, '\n');
+        if(newline == NULL) {
+            found = false;
+            break;
+        }
+        *newline = '\0';
+        CacheHash content;
+        found = hashFile(line, &content);
+        if(found) *entry = entryKey(*entry, line, content);
+        line = newline + 1;
+    }
+    free(manifest);
+    return found;
+}
+
+bool loadCachedUnit(const char* cache, const char* path, AssemblerOptions* options,
+        Object* object, CacheHash* entry) {
+    if(!findEntry(cache, path, options, entry)) return false;
+
+    char unitPath[PATH_MAX];
+    if(!cachePath(unitPath, cache, *entry, ".unit")) return false;
+    size_t length;
+    uint8_t* buffer = readWhole(unitPath, &length);
+    if(buffer == NULL) return false;
+    if(!decodeUnit(buffer, length, object)) {
+        free(buffer);
+        return false;
+    }
+    object->path = path;
+    object->storage = buffer;
+    return true;
+}
+
+CacheHash storeCachedUnit(const char* cache, const char* path, AssemblerOptions* options,
+        Object* object, CacheHash* hashes) {
+    // the first file is the unit itself, an include read twice is listed once
+    CacheHash key = unitKey(path, options, hashes[0]);
+    CacheHash entry = key;
+
+    // the manifest is one path per line, so a unit including a path with a
+    // newline in it can't be checked later and is never cached. a manifest
+    // left for its source by an earlier build is dropped too.
+    for(uint32_t i = 1; i < object->fileCount; i++) {
+        if(strchr(object->files[i], '\n') == NULL) continue;
+        char manifestPath[PATH_MAX];
+        if(cachePath(manifestPath, cache, key, ".manifest")) unlink(manifestPath);
+        return entry;
+    }
+
+    size_t manifestLength = 0;
+    char* manifest = malloc(1);
+    for(uint32_t i = 1; i < object->fileCount && manifest != NULL; i++) {
+        bool seen = false;
+        for(uint32_t j = 1; j < i && !seen; j++)
+            seen = strcmp(object->files[i], object->files[j]) == 0;
+        if(seen) continue;
+
+        size_t nameLength = strlen(object->files[i]);
+        manifest = realloc(manifest, manifestLength + nameLength + 2);
+        if(manifest == NULL) break;
+        memcpy(manifest + manifestLength, object->files[i], nameLength);
+        manifest[manifestLength + nameLength] = '\n';
+        manifestLength += nameLength + 1;
+        entry = entryKey(entry, object->files[i], hashes[i]);
+    }
+    if(manifest == NULL) return entry;
+
+    size_t objectLength;
+    uint8_t* bytes = encodeObject(object, &objectLength);
+    size_t length = objectLength + 8 + (size_t)object->lineCount * 12;
+    for(uint32_t i = 0; i < object->fileCount; i++)
+        length += 2 + strlen(object->files[i]);
+
+    uint8_t* buffer = realloc(bytes, length);
+    if(buffer == NULL) {
+        free(bytes);
+        free(manifest);
+        return entry;
+    }
+    uint8_t* p = put32(buffer + objectLength, object->fileCount);
+    for(uint32_t i = 0; i < object->fileCount; i++) {
+        size_t nameLength = strlen(object->files[i]);
+        *p++ = (uint8_t)(nameLength >> 8);
+        *p++ = (uint8_t)nameLength;
+        memcpy(p, object->files[i], nameLength);
+        p += nameLength;
+    }
+    p = put32(p, object->lineCount);
+    for(uint32_t i = 0; i < object->lineCount; i++) {
+        p = put32(p, object->lines[i].offset);
+        p = put32(p, object->lines[i].file);
+        p = put32(p, object->lines[i].line);
+    }
+
+    // the entry goes first, so a build that finds the new manifest finds it too
+    char unitPath[PATH_MAX];
+    char manifestPath[PATH_MAX];
+    if(cachePath(unitPath, cache, entry, ".unit") && cachePath(manifestPath, cache, key, ".manifest")) {
+        writeAtomically(cache, unitPath, buffer, length);
+        writeAtomically(cache, manifestPath, (uint8_t*)manifest, manifestLength);
+    }
+    free(buffer);
+    free(manifest);
+    return entry;
+}
+
+static CacheHash imageKey(CacheHash* entries, int count, AssemblerOptions* options) {
+    CacheHash hash = hashName(FNV128_OFFSET, CACHE_FORMAT " image");
+    uint8_t debug = options->debug;
+    hash = hashBytes(hash, &debug, sizeof(debug));
+    for(int i = 0; i < count; i++)
+        hash = hashValue(hash, entries[i]);
+    return hash;
+}
+
+static bool copyOut(const char* cache, CacheHash key, const char* suffix, const char* path) {
+    char cached[PATH_MAX];
+    if(!cachePath(cached, cache, key, suffix)) return false;
+    size_t length;
+    uint8_t* bytes = readWhole(cached, &length);
+    if(bytes == NULL) return false;
+
+    struct iovec iov[1];
+    iov[0].iov_base = bytes;
+    iov[0].iov_len = length;
+    writeOutput(path, iov, 1);
+    free(bytes);
+    return true;
+}
+
+static void copyIn(const char* cache, CacheHash key, const char* suffix, const char* path) {
+    char cached[PATH_MAX];
+    if(!cachePath(cached, cache, key, suffix)) return;
+    size_t length;
+    uint8_t* bytes = readWhole(path, &length);
+    if(bytes == NULL) return;
+    writeAtomically(cache, cached, bytes, length);
+    free(bytes);
+}
+
+static bool debugPath(char* buffer, const char* outf) {
+    return snprintf(buffer, PATH_MAX, "%s.sdbg", outf) < PATH_MAX;
+}
+
+bool loadCachedImage(const char* cache, const char** inputs, int count, AssemblerOptions* options, const char* outf) {
+    CacheHash* entries = malloc(sizeof(CacheHash) * count);
+    if(entries == NULL) return false;
+    for(int i = 0; i < count; i++) {
+        if(!findEntry(cache, inputs[i], options, &entries[i])) {
+            free(entries);
+            return false;
+        }
+    }
+    CacheHash key = imageKey(entries, count, options);
+    free(entries);
+
+    // the debug info is stored before the image, so with the image present
+    // it is only missing if the cache was pruned
+    char path[PATH_MAX];
+    if(options->debug && !(debugPath(path, outf) && copyOut(cache, key, ".sdbg", path)))
+        return false;
+    return copyOut(cache, key, ".image", outf);
+}
+
+void storeCachedImage(const char* cache, CacheHash* entries, int count, AssemblerOptions* options, const char* outf) {
+    CacheHash key = imageKey(entries, count, options);
+    char path[PATH_MAX];
+    if(options->debug && debugPath(path, outf))
+        copyIn(cache, key, ".sdbg", path);
+    copyIn(cache, key, ".image", outf);
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+
+#include "isa.h"
+#include "table.h"
+#include "vm.h"
+
+static PerfectHash mnemonics;
+static PerfectHash registers;
+
+static const char* mnemonicNames[256];
+static uint8_t mnemonicOpcodes[256];
+
+static uint32_t perfectSlot(PerfectHash* table, uint32_t hash) {
+    return ((hash ^ table->seed) * 0x9E3779B1u) >> table->shift;
+}
+
+static bool tryPerfectHash(PerfectHash* table, uint32_t* hashes) {
+    for(int i = 0; i < table->capacity; i++) table->slots[i] = -1;
+    for(int i = 0; i < table->count; i++) {
+        uint32_t slot = perfectSlot(table, hashes[i]);
+        if(table->slots[slot] != -1) return false;
+        table->slots[slot] = (int16_t)i;
+    }
+    return true;
+}
+
+void buildPerfectHash(PerfectHash* table, const char** names, int count) {
+    uint32_t* hashes = malloc(sizeof(uint32_t) * count);
+    if(hashes == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    for(int i = 0; i < count; i++)
+        hashes[i] = hashString(names[i], (int)strlen(names[i]));
+
+    table->names = names;
+    table->count = count;
+    table->slots = NULL;
+
+    // start at twice the number of names and widen until a seed separates them
+    int bits = 1;
+    while((1 << bits) < count * 2) bits++;
+    for(; bits <= 16; bits++) {
+        table->shift = 32 - bits;
+        table->capacity = 1 << bits;
+        table->slots = realloc(table->slots, sizeof(int16_t) * table->capacity);
+        for(table->seed = 0; table->seed < 4096; table->seed++) {
+            if(tryPerfectHash(table, hashes)) {
+                free(hashes);
+                return;
+            }
+        }
+    }
+
+    fprintf(stderr, "could not build a perfect hash for %d names.\n", count);
+    exit(1);
+}
+
+int perfectHashLookup(PerfectHash* table, const char* chars, int length, uint32_t hash) {
+    int index = table->slots[perfectSlot(table, hash)];
+    if(index < 0) return -1;
+
+    const char* name = table->names[index];
+    if(strncmp(name, chars, length) != 0 || name[length] != '\0') return -1;
+    return index;
+}
+
+// must run before any unit is assembled, the tables are read-only afterwards
+void initInstructionSet() {
+    int count = 0;
+    for(int opcode = 0; opcode < 256; opcode++) {
+        if(instructionInfo[opcode].mnemonic == NULL) continue;
+        mnemonicNames[count] = instructionInfo[opcode].mnemonic;
+        mnemonicOpcodes[count] = (uint8_t)opcode;
+        count++;
+    }
+    buildPerfectHash(&mnemonics, mnemonicNames, count);
+    buildPerfectHash(&registers, registerNames, NUM_REGS);
+}
+
+const InstructionInfo* lookupInstruction(const char* chars, int length, uint32_t hash, uint8_t* opcode) {
+    int index = perfectHashLookup(&mnemonics, chars, length, hash);
+    if(index < 0) return NULL;
+    *opcode = mnemonicOpcodes[index];
+    return &instructionInfo[*opcode];
+}
+
+int lookupRegister(const char* chars, int length, uint32_t hash) {
+    return perfectHashLookup(&registers, chars, length, hash);
+}
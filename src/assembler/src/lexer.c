@@ -0,0 +1,81 @@
+#include "lexer.h"
+
+void initLexer(Lexer* lexer, const char* source, size_t length) {
+    lexer->current = source;
+    lexer->end = source + length;
+    lexer->line = 1;
+}
+
+static bool isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == ',';
+}
+
+static bool isWordEnd(char c) {
+    return isSeparator(c) || c == '\n' || c == ';' || c == '"';
+}
+
+static Token makeToken(Lexer* lexer, TokenType type, const char* start, int length, uint32_t hash) {
+    Token token;
+    token.type = type;
+    token.start = start;
+    token.length = length;
+    token.hash = hash;
+    token.line = lexer->line;
+    return token;
+}
+
+Token scanToken(Lexer* lexer) {
+    for(;;) {
+        if(lexer->current == lexer->end) return makeToken(lexer, TOKEN_EOF, lexer->current, 0, 0);
+
+        char c = *lexer->current;
+        if(isSeparator(c)) {
+            lexer->current++;
+        } else if(c == ';') {
+            // comment runs to the end of the line, the newline is still a token
+            const char* newline = memchr(lexer->current, '\n', lexer->end - lexer->current);
+            lexer->current = newline == NULL ? lexer->end : newline;
+        } else {
+            break;
+        }
+    }
+
+    const char* start = lexer->current;
+    char c = *lexer->current++;
+
+    if(c == '\n') {
+        Token token = makeToken(lexer, TOKEN_NEWLINE, start, 1, 0);
+        lexer->line++;
+        return token;
+    }
+
+    if(c == '"') {
+        start = lexer->current;
+        while(lexer->current < lexer->end && *lexer->current != '"' && *lexer->current != '\n')
+            lexer->current++;
+        if(lexer->current == lexer->end || *lexer->current != '"')
+            return makeToken(lexer, TOKEN_ERROR, "unterminated string", 19, 0);
+        Token token = makeToken(lexer, TOKEN_STRING, start, (int)(lexer->current - start), 0);
+        lexer->current++;
+        return token;
+    }
+
+    // hash the word as it is scanned so mnemonics and registers never need a second pass
+    uint32_t hash = 2166136261u;
+    hash ^= (uint8_t)c;
+    hash *= 16777619;
+    while(lexer->current < lexer->end && !isWordEnd(*lexer->current)) {
+        if(*lexer->current == ':') {
+            Token token = makeToken(lexer, TOKEN_LABEL, start, (int)(lexer->current - start), hash);
+            lexer->current++;
+            return token;
+        }
+        hash ^= (uint8_t)*lexer->current++;
+        hash *= 16777619;
+    }
+
+    int length = (int)(lexer->current - start);
+    if(c == '%') return makeToken(lexer, TOKEN_DIRECTIVE, start, length, hash);
+    if(c >= '0' && c <= '9') return makeToken(lexer, TOKEN_NUMBER, start, length, hash);
+    return makeToken(lexer, TOKEN_WORD, start, length, hash);
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+
+#include "assembler.h"
+#include "debuginfo.h"
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    uint8_t* data;
+} ByteBuffer;
+
+static void putByte(ByteBuffer* buffer, uint8_t byte) {
+    if(buffer->capacity < buffer->count + 1) {
+        buffer->capacity = GROW_CAPACITY(buffer->capacity);
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if(buffer->data == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+    }
+    buffer->data[buffer->count++] = byte;
+}
+
+static void put16(ByteBuffer* buffer, uint16_t value) {
+    putByte(buffer, value >> 8);
+    putByte(buffer, (uint8_t)value);
+}
+
+static void put32(ByteBuffer* buffer, uint32_t value) {
+    putByte(buffer, value >> 24);
+    putByte(buffer, (uint8_t)(value >> 16));
+    putByte(buffer, (uint8_t)(value >> 8));
+    putByte(buffer, (uint8_t)value);
+}
+
+static void putUleb(ByteBuffer* buffer, uint32_t value) {
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        putByte(buffer, value != 0 ? byte | 0x80 : byte);
+    } while(value != 0);
+}
+
+static void putSleb(ByteBuffer* buffer, int32_t value) {
+    for(;;) {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40))) {
+            putByte(buffer, byte);
+            return;
+        }
+        putByte(buffer, byte | 0x80);
+    }
+}
+
+static void putName(ByteBuffer* buffer, const char* name, int length) {
+    put16(buffer, (uint16_t)length);
+    for(int i = 0; i < length; i++)
+        putByte(buffer, (uint8_t)name[i]);
+}
+
+static int compareLabels(const void* a, const void* b) {
+    const DebugLabel* left = a;
+    const DebugLabel* right = b;
+    if(left->address != right->address) return left->address < right->address ? -1 : 1;
+    return strcmp(left->name, right->name);
+}
+
+// units share their include files, each path is written once
+static uint32_t findFile(const char** files, uint32_t* fileCount, const char* path) {
+    for(uint32_t i = 0; i < *fileCount; i++)
+        if(strcmp(files[i], path) == 0) return i;
+    files[*fileCount] = path;
+    return (*fileCount)++;
+}
+
+// rows within a small step of the previous one fit a single special opcode,
+// everything else is spelled out with the advance opcodes
+static void putRow(ByteBuffer* program, uint32_t addressDelta, int32_t lineDelta) {
+    if(lineDelta >= DBG_LINE_BASE && lineDelta < DBG_LINE_BASE + DBG_LINE_RANGE) {
+        uint32_t opcode = DBG_OPCODE_BASE + (lineDelta - DBG_LINE_BASE) + DBG_LINE_RANGE * addressDelta;
+        if(addressDelta <= 0xFF && opcode <= 0xFF) {
+            putByte(program, (uint8_t)opcode);
+            return;
+        }
+    }
+
+    if(lineDelta != 0) {
+        putByte(program, DBG_ADVANCE_LINE);
+        putSleb(program, lineDelta);
+    }
+    if(addressDelta != 0) {
+        putByte(program, DBG_ADVANCE_ADDRESS);
+        putUleb(program, addressDelta);
+    }
+    putByte(program, DBG_ROW);
+}
+
+void writeDebugInfo(const char* path, Image* image) {
+    uint32_t totalFiles = 0;
+    uint32_t totalSymbols = 0;
+    for(int i = 0; i < image->count; i++) {
+        totalFiles += image->objects[i].fileCount;
+        totalSymbols += image->objects[i].symbolCount;
+    }
+
+    const char** files = malloc(sizeof(const char*) * (totalFiles + 1));
+    DebugLabel* labels = malloc(sizeof(DebugLabel) * (totalSymbols + 1));
+    char** names = malloc(sizeof(char*) * (totalSymbols + 1));
+    if(files == NULL || labels == NULL || names == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    ByteBuffer program = { 0, 0, NULL };
+    uint32_t fileCount = 0;
+    uint32_t labelCount = 0;
+    uint32_t address = 0;
+    uint32_t file = 0;
+    uint32_t line = 1;
+
+    uint32_t base = ENTRY_SIZE;
+    for(int i = 0; i < image->count; i++) {
+        Object* object = &image->objects[i];
+
+        for(uint32_t j = 0; j < object->symbolCount; j++) {
+            ObjectSymbol* symbol = &object->symbols[j];
+            if(!(symbol->flags & SYMBOL_DEFINED)) continue;
+            names[labelCount] = strndup(symbol->name, symbol->length);
+            labels[labelCount].name = names[labelCount];
+            labels[labelCount].address = base + symbol->value;
+            labelCount++;
+        }
+
+        for(uint32_t j = 0; j < object->lineCount; j++) {
+            SourceLine* row = &object->lines[j];
+            uint32_t rowFile = findFile(files, &fileCount, object->files[row->file]);
+            if(rowFile != file) {
+                putByte(&program, DBG_SET_FILE);
+                putUleb(&program, rowFile);
+                file = rowFile;
+            }
+            putRow(&program, base + row->offset - address, (int32_t)(row->line - line));
+            address = base + row->offset;
+            line = row->line;
+        }
+
+        base += object->codeSize;
+    }
+    putByte(&program, DBG_END);
+
+    qsort(labels, labelCount, sizeof(DebugLabel), compareLabels);
+
+    ByteBuffer tables = { 0, 0, NULL };
+    for(uint32_t i = 0; i < fileCount; i++)
+        putName(&tables, files[i], (int)strlen(files[i]));
+    for(uint32_t i = 0; i < labelCount; i++) {
+        put32(&tables, labels[i].address);
+        putName(&tables, labels[i].name, (int)strlen(labels[i].name));
+    }
+
+    ByteBuffer header = { 0, 0, NULL };
+    for(int i = 0; i < 4; i++)
+        putByte(&header, (uint8_t)DEBUG_MAGIC[i]);
+    put16(&header, DEBUG_VERSION);
+    put32(&header, fileCount);
+    put32(&header, labelCount);
+    put32(&header, (uint32_t)program.count);
+
+    struct iovec iov[3];
+    iov[0].iov_base = header.data;
+    iov[0].iov_len = header.count;
+    iov[1].iov_base = tables.data;
+    iov[1].iov_len = tables.count;
+    iov[2].iov_base = program.data;
+    iov[2].iov_len = program.count;
+    writeOutput(path, iov, 3);
+
+    for(uint32_t i = 0; i < labelCount; i++)
+        free(names[i]);
+    free(names);
+    free(labels);
+    free(files);
+    free(header.data);
+    free(tables.data);
+    free(program.data);
+}
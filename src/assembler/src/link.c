@@ -0,0 +1,180 @@
+#include <stdio.h>
+
+#include "object.h"
+#include "opcodes.h"
+#include "table.h"
+
+static Symbol* lookupSymbol(Table* strings, ObjectSymbol* symbol) {
+    return internSymbol(strings, symbol->name, symbol->length, hashString(symbol->name, symbol->length));
+}
+
+static void patch16(uint8_t* code, uint32_t offset, uint32_t value) {
+    code[offset] = value >> 8;
+    code[offset + 1] = (uint8_t)value;
+}
+
+// every object's strings go into one pool after the code, each distinct
+// string once, in the order they are first referenced
+static void buildPool(Object* objects, int count, Image* image, Table* strings) {
+    Table entries;
+    initTable(&entries);
+
+    uint32_t size = POOL_HEADER_SIZE;
+    for(int i = 0; i < count; i++) {
+        Object* object = &objects[i];
+        for(uint32_t j = 0; j < object->stringCount; j++) {
+            PoolString* string = &object->strings[j];
+            Symbol* key = internSymbol(strings, string->chars, string->length, hashString(string->chars, string->length));
+            if(tableGet(&entries, key) != NULL) continue;
+            tableSet(&entries, key, size);
+            size += POOL_LENGTH_SIZE + string->length;
+        }
+    }
+    if(size == POOL_HEADER_SIZE) {
+        freeTable(&entries);
+        image->pool = NULL;
+        image->poolSize = 0;
+        return;
+    }
+    if(image->size + size > 0x10000) {
+        fprintf(stderr, "string pool at 0x%x is outside the 16-bit address space.\n", image->size);
+        exit(1);
+    }
+
+    image->pool = malloc(size);
+    if(image->pool == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    image->poolSize = size;
+    image->pool[0] = OP_POOL;
+    patch16(image->pool, 1, size - POOL_HEADER_SIZE);
+
+    for(int i = 0; i < count; i++) {
+        Object* object = &objects[i];
+        uint32_t* addresses = malloc(sizeof(uint32_t) * (object->stringCount + 1));
+        if(addresses == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+        for(uint32_t j = 0; j < object->stringCount; j++) {
+            PoolString* string = &object->strings[j];
+            Symbol* key = internSymbol(strings, string->chars, string->length, hashString(string->chars, string->length));
+            uint32_t offset = tableGet(&entries, key)->value;
+            patch16(image->pool, offset, (uint32_t)string->length);
+            memcpy(image->pool + offset + POOL_LENGTH_SIZE, string->chars, string->length);
+            addresses[j] = image->size + offset;
+        }
+        for(uint32_t j = 0; j < object->stringRelocationCount; j++) {
+            Relocation* relocation = &object->stringRelocations[j];
+            patch16(object->code, relocation->offset, addresses[relocation->symbol]);
+        }
+        free(addresses);
+    }
+    freeTable(&entries);
+}
+
+// objects are laid out after the entry stub in the order given, so the same
+// inputs always produce the same image
+void linkObjects(Object* objects, int count, Image* image) {
+    Table strings;
+    Table globals;
+    initTable(&strings);
+    initTable(&globals);
+
+    uint32_t base = ENTRY_SIZE;
+    for(int i = 0; i < count; i++) {
+        Object* object = &objects[i];
+        for(uint32_t j = 0; j < object->symbolCount; j++) {
+            ObjectSymbol* symbol = &object->symbols[j];
+            if(!(symbol->flags & SYMBOL_DEFINED)) continue;
+
+            Symbol* key = lookupSymbol(&strings, symbol);
+            Entry* entry = tableGet(&globals, key);
+            if(entry != NULL && entry->defined) {
+                fprintf(stderr, "label `%s` defined more than once (in `%s`).\n", key->chars, object->path);
+                exit(1);
+            }
+            entry = tableSet(&globals, key, base + symbol->value);
+            entry->defined = true;
+        }
+        base += object->codeSize;
+    }
+
+    // resolve each object's symbols once, relocations then only index the result
+    for(int i = 0; i < count; i++) {
+        Object* object = &objects[i];
+        uint32_t* values = malloc(sizeof(uint32_t) * (object->symbolCount + 1));
+        if(values == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+
+        for(uint32_t j = 0; j < object->symbolCount; j++) {
+            Symbol* key = lookupSymbol(&strings, &object->symbols[j]);
+            Entry* entry = tableGet(&globals, key);
+            values[j] = (entry == NULL || !entry->defined) ? UINT32_MAX : entry->value;
+        }
+
+        for(uint32_t j = 0; j < object->relocationCount; j++) {
+            Relocation* relocation = &object->relocations[j];
+            uint32_t value = values[relocation->symbol];
+            ObjectSymbol* symbol = &object->symbols[relocation->symbol];
+            if(value == UINT32_MAX) {
+                fprintf(stderr, "label `%.*s` does not exist.\n", symbol->length, symbol->name);
+                exit(1);
+            }
+            if(value > 0xFFFF) {
+                fprintf(stderr, "label `%.*s` at 0x%x is outside the 16-bit address space.\n", symbol->length, symbol->name, value);
+                exit(1);
+            }
+
+            patch16(object->code, relocation->offset, value);
+        }
+
+        free(values);
+    }
+
+    Entry* main = tableGet(&globals, internSymbol(&strings, "main", 4, hashString("main", 4)));
+    if(main == NULL || !main->defined) {
+        fprintf(stderr, "main label does not exist.\n");
+        exit(1);
+    }
+
+    // the image is always entered at 0, so it starts with a `jmp main`
+    image->entry[0] = OP_JMP;
+    image->entry[1] = main->value >> 8;
+    image->entry[2] = (uint8_t)main->value;
+    image->objects = objects;
+    image->count = count;
+    image->size = base;
+    buildPool(objects, count, image, &strings);
+
+    freeTable(&globals);
+    freeSymbols(&strings);
+}
+
+// objects are patched in place, so the image is written straight from their code buffers
+void writeImage(const char* path, Image* image) {
+    struct iovec* iov = malloc(sizeof(struct iovec) * (image->count + 2));
+    if(iov == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    iov[0].iov_base = image->entry;
+    iov[0].iov_len = ENTRY_SIZE;
+    for(int i = 0; i < image->count; i++) {
+        iov[i + 1].iov_base = image->objects[i].code;
+        iov[i + 1].iov_len = image->objects[i].codeSize;
+    }
+
+    int iovcnt = image->count + 1;
+    if(image->pool != NULL) {
+        iov[iovcnt].iov_base = image->pool;
+        iov[iovcnt].iov_len = image->poolSize;
+        iovcnt++;
+    }
+    writeOutput(path, iov, iovcnt);
+    free(iov);
+}
@@ -1,5 +1,7 @@
+#include <getopt.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "assembler.h"
 #include "common.h"
@@ -9,24 +11,81 @@ static bool file_exists(char *filename) {
     return (stat(filename, &buffer) == 0);
 }
 
+static void print_usage(char** argv) {
+    fprintf(stderr, "usage: %s [-c] [-g] [-O] [-j jobs] [-C cache] [-o out] [input...]\n", argv[0]);
+    fprintf(stderr, "       %s [input] [out]\n", argv[0]);
+}
+
+static bool endsWith(const char* str, const char* suffix) {
+    size_t length = strlen(str), suffixLength = strlen(suffix);
+    return length >= suffixLength && strcmp(str + length - suffixLength, suffix) == 0;
+}
+
 int main(int argc, char** argv) {
-    if(argc < 2) {
+    AssemblerOptions options;
+    options.object = false;
+    options.optimize = false;
+    options.debug = false;
+    options.jobs = 0;
+    options.cache = getenv("SYNAS_CACHE");
+    char* output = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "cgj:o:OC:")) != -1) {
+        switch(opt) {
+            case 'c': options.object = true; break;
+            case 'g': options.debug = true; break;
+            case 'j': options.jobs = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            case 'O': options.optimize = true; break;
+            case 'C': options.cache = optarg; break;
+            default:
+                print_usage(argv);
+                return 1;
+        }
+    }
+
+    if(optind >= argc) {
         fprintf(stderr, "%s: \e[31;1mfatal error\e[0m: no input file specified\n", argv[0]);
-        fprintf(stderr, "usage: %s [input] [out?]\n", argv[0]);
+        print_usage(argv);
         return 1;
     }
 
-    if(!file_exists(argv[1])) {
-        fprintf(stderr, "input file `%s` does not exist.\n", argv[1]);
+    const char** inputs = (const char**)&argv[optind];
+    int count = argc - optind;
+
+    // `synas input out` predates -o, keep it working when out is not a source
+    if(output == NULL && count == 2 && !endsWith(inputs[1], ".sasm")) {
+        output = argv[optind + 1];
+        count = 1;
+    }
+
+    for(int i = 0; i < count; i++) {
+        if(!file_exists((char*)inputs[i])) {
+            fprintf(stderr, "input file `%s` does not exist.\n", inputs[i]);
+            return 1;
+        }
+    }
+
+    if(options.object && output != NULL && count > 1) {
+        fprintf(stderr, "%s: \e[31;1mfatal error\e[0m: cannot use -o with -c and multiple input files\n", argv[0]);
         return 1;
     }
+    if(options.object && options.debug) {
+        fprintf(stderr, "%s: \e[31;1mfatal error\e[0m: -g needs an image, objects don't carry debug info\n", argv[0]);
+        return 1;
+    }
+    if(!options.object && output == NULL)
+        output = "a.out";
 
+    if(options.cache != NULL && options.cache[0] == '\0')
+        options.cache = NULL;
 
-    FILE* file = fopen(argv[1], "r");
+    if(options.jobs <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        options.jobs = cpus > 0 ? (int)cpus : 1;
+    }
 
-    if(argc == 3)
-        assemble(file, argv[2]);
-    else
-        assemble(file, "a.out");
+    assemble(inputs, count, output, &options);
     return 0;
-}
\ No newline at end of file
+}
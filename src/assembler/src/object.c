@@ -0,0 +1,236 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "object.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+void writeOutput(const char* path, struct iovec* iov, int iovcnt) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        fprintf(stderr, "error opening output file `%s`.\n", path);
+        exit(1);
+    }
+
+    // writev may stop short, so advance through the vectors until all is out
+    struct iovec* vec = iov;
+    while(iovcnt > 0) {
+        ssize_t written = writev(fd, vec, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+        if(written < 0) {
+            fprintf(stderr, "error writing output file `%s`.\n", path);
+            exit(1);
+        }
+        while(iovcnt > 0 && (size_t)written >= vec->iov_len) {
+            written -= vec->iov_len;
+            vec++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            vec->iov_base = (uint8_t*)vec->iov_base + written;
+            vec->iov_len -= written;
+        }
+    }
+
+    close(fd);
+}
+
+static uint8_t* put16(uint8_t* p, uint16_t value) {
+    p[0] = value >> 8;
+    p[1] = (uint8_t)value;
+    return p + 2;
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+    return p + 4;
+}
+
+static uint16_t get16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// header, code and tables in one buffer, as written to an object file
+uint8_t* encodeObject(Object* object, size_t* size) {
+    size_t tableSize = (object->relocationCount + object->stringRelocationCount) * 8;
+    for(uint32_t i = 0; i < object->symbolCount; i++)
+        tableSize += 7 + object->symbols[i].length;
+    for(uint32_t i = 0; i < object->stringCount; i++)
+        tableSize += 2 + object->strings[i].length;
+
+    *size = OBJECT_HEADER_SIZE + object->codeSize + tableSize;
+    uint8_t* buffer = malloc(*size);
+    if(buffer == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    uint8_t* p = buffer;
+    memcpy(p, OBJECT_MAGIC, 4);
+    p = put16(p + 4, OBJECT_VERSION);
+    p = put32(p, object->codeSize);
+    p = put32(p, object->symbolCount);
+    p = put32(p, object->relocationCount);
+    p = put32(p, object->stringCount);
+    p = put32(p, object->stringRelocationCount);
+    memcpy(p, object->code, object->codeSize);
+    p += object->codeSize;
+
+    for(uint32_t i = 0; i < object->symbolCount; i++) {
+        ObjectSymbol* symbol = &object->symbols[i];
+        *p++ = symbol->flags;
+        p = put32(p, symbol->value);
+        p = put16(p, (uint16_t)symbol->length);
+        memcpy(p, symbol->name, symbol->length);
+        p += symbol->length;
+    }
+    for(uint32_t i = 0; i < object->relocationCount; i++) {
+        p = put32(p, object->relocations[i].offset);
+        p = put32(p, object->relocations[i].symbol);
+    }
+    for(uint32_t i = 0; i < object->stringCount; i++) {
+        p = put16(p, (uint16_t)object->strings[i].length);
+        memcpy(p, object->strings[i].chars, object->strings[i].length);
+        p += object->strings[i].length;
+    }
+    for(uint32_t i = 0; i < object->stringRelocationCount; i++) {
+        p = put32(p, object->stringRelocations[i].offset);
+        p = put32(p, object->stringRelocations[i].symbol);
+    }
+    return buffer;
+}
+
+void writeObject(const char* path, Object* object) {
+    size_t size;
+    uint8_t* buffer = encodeObject(object, &size);
+
+    struct iovec iov[1];
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = size;
+    writeOutput(path, iov, 1);
+
+    free(buffer);
+}
+
+// symbol names and code point into buffer, which has to outlive the object.
+// returns what is wrong with the buffer, or NULL, and the bytes used in *used
+const char* decodeObject(uint8_t* buffer, size_t size, Object* object, size_t* used) {
+    if(size < OBJECT_HEADER_SIZE || memcmp(buffer, OBJECT_MAGIC, 4) != 0 ||
+            get16(buffer + 4) != OBJECT_VERSION)
+        return "is not a synthetic object file";
+
+    object->files = NULL;
+    object->fileCount = 0;
+    object->lines = NULL;
+    object->lineCount = 0;
+    object->codeSize = get32(buffer + 6);
+    object->symbolCount = get32(buffer + 10);
+    object->relocationCount = get32(buffer + 14);
+    object->stringCount = get32(buffer + 18);
+    object->stringRelocationCount = get32(buffer + 22);
+
+    const uint8_t* end = buffer + size;
+    uint8_t* p = buffer + OBJECT_HEADER_SIZE;
+    if((size_t)(end - p) < object->codeSize) return "is truncated";
+    object->code = p;
+    p += object->codeSize;
+
+    object->symbols = malloc(sizeof(ObjectSymbol) * object->symbolCount);
+    object->relocations = malloc(sizeof(Relocation) * object->relocationCount);
+    object->strings = malloc(sizeof(PoolString) * object->stringCount);
+    object->stringRelocations = malloc(sizeof(Relocation) * object->stringRelocationCount);
+    for(uint32_t i = 0; i < object->symbolCount; i++) {
+        if(end - p < 7) return "is truncated";
+        ObjectSymbol* symbol = &object->symbols[i];
+        symbol->flags = p[0];
+        symbol->value = get32(p + 1);
+        symbol->length = get16(p + 5);
+        p += 7;
+        if(end - p < symbol->length) return "is truncated";
+        symbol->name = (const char*)p;
+        p += symbol->length;
+    }
+    for(uint32_t i = 0; i < object->relocationCount; i++) {
+        if(end - p < 8) return "is truncated";
+        object->relocations[i].offset = get32(p);
+        object->relocations[i].symbol = get32(p + 4);
+        p += 8;
+        if(object->relocations[i].symbol >= object->symbolCount ||
+                object->relocations[i].offset + 2 > object->codeSize)
+            return "has an invalid relocation";
+    }
+    for(uint32_t i = 0; i < object->stringCount; i++) {
+        if(end - p < 2) return "is truncated";
+        PoolString* string = &object->strings[i];
+        string->length = get16(p);
+        p += 2;
+        if(end - p < string->length) return "is truncated";
+        string->chars = (const char*)p;
+        p += string->length;
+    }
+    for(uint32_t i = 0; i < object->stringRelocationCount; i++) {
+        if(end - p < 8) return "is truncated";
+        object->stringRelocations[i].offset = get32(p);
+        object->stringRelocations[i].symbol = get32(p + 4);
+        p += 8;
+        if(object->stringRelocations[i].symbol >= object->stringCount ||
+                object->stringRelocations[i].offset + 2 > object->codeSize)
+            return "has an invalid string relocation";
+    }
+    *used = (size_t)(p - buffer);
+    return NULL;
+}
+
+// the file stays in memory for the lifetime of the object, symbol names point into it
+bool readObject(const char* path, Object* object) {
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "object file `%s` does not exist.\n", path);
+        return false;
+    }
+
+    fseek(file, 0L, SEEK_END);
+    size_t fileSize = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+
+    uint8_t* buffer = malloc(fileSize);
+    if(buffer == NULL || fread(buffer, 1, fileSize, file) < fileSize) {
+        fprintf(stderr, "error reading object file `%s`.\n", path);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    size_t used;
+    const char* problem = decodeObject(buffer, fileSize, object, &used);
+    if(problem != NULL) {
+        fprintf(stderr, "`%s` %s.\n", path, problem);
+        return false;
+    }
+    object->path = path;
+    object->storage = buffer;
+    return true;
+}
+
+void freeObject(Object* object) {
+    for(uint32_t i = 0; i < object->fileCount; i++)
+        free((char*)object->files[i]);
+    free(object->files);
+    free(object->lines);
+    free(object->symbols);
+    free(object->relocations);
+    free(object->strings);
+    free(object->stringRelocations);
+    free(object->storage);
+}
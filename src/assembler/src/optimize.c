@@ -0,0 +1,306 @@
+#include <stdio.h>
+
+#include "assembler.h"
+#include "vm.h"
+
+// peephole passes over the instruction list, labels hold instruction indices
+// at this point so removing an instruction only needs the labels remapped
+
+typedef struct {
+    Assembler* assembler;
+    bool* labeled;              // a defined label points at the instruction
+    bool* removed;
+    bool changed;
+} Optimizer;
+
+static Instruction* instructionAt(Optimizer* optimizer, int index) {
+    if(index < 0 || index >= optimizer->assembler->instructionCount) return NULL;
+    return &optimizer->assembler->instructions[index];
+}
+
+static int labelTarget(Optimizer* optimizer, Symbol* label) {
+    Entry* entry = tableGet(&optimizer->assembler->labels, label);
+    if(entry == NULL || !entry->defined) return -1;
+    return (int)entry->value;
+}
+
+static void markLabels(Optimizer* optimizer) {
+    Assembler* assembler = optimizer->assembler;
+    memset(optimizer->labeled, 0, sizeof(bool) * (assembler->instructionCount + 1));
+    memset(optimizer->removed, 0, sizeof(bool) * (assembler->instructionCount + 1));
+    for(int i = 0; i < assembler->labels.capacity; i++) {
+        Entry* entry = &assembler->labels.entries[i];
+        if(entry->key != NULL && entry->defined)
+            optimizer->labeled[entry->value] = true;
+    }
+}
+
+static void removeInstruction(Optimizer* optimizer, int index) {
+    optimizer->removed[index] = true;
+    optimizer->changed = true;
+}
+
+static bool isBranch(uint8_t opcode) {
+    ControlFlow flow = instructionInfo[opcode].flow;
+    return flow == FLOW_JUMP || flow == FLOW_BRANCH || flow == FLOW_CALL || flow == FLOW_SPAWN;
+}
+
+static bool endsBlock(uint8_t opcode) {
+    return opcode == OP_JMP || opcode == OP_RET || opcode == OP_RETW || opcode == OP_HALT;
+}
+
+// branches to a `jmp` go straight to its target, a `jmp` to a `ret`, `retw`
+// or `halt` becomes that instruction
+static void threadJumps(Optimizer* optimizer) {
+    Assembler* assembler = optimizer->assembler;
+    for(int i = 0; i < assembler->instructionCount; i++) {
+        Instruction* instruction = &assembler->instructions[i];
+        if(!isBranch(instruction->opcode) || instruction->label == NULL) continue;
+
+        // a chain that loops back on itself is left alone
+        Symbol* label = instruction->label;
+        for(int steps = 0; steps < assembler->instructionCount; steps++) {
+            Instruction* target = instructionAt(optimizer, labelTarget(optimizer, label));
+            if(target == NULL || target->opcode != OP_JMP || target->label == NULL) {
+                if(label != instruction->label) {
+                    instruction->label = label;
+                    optimizer->changed = true;
+                }
+                break;
+            }
+            label = target->label;
+        }
+
+        Instruction* target = instructionAt(optimizer, labelTarget(optimizer, instruction->label));
+        if(instruction->opcode == OP_JMP && target != NULL &&
+                (target->opcode == OP_RET || target->opcode == OP_RETW || target->opcode == OP_HALT)) {
+            instruction->opcode = target->opcode;
+            instruction->label = NULL;
+            optimizer->changed = true;
+        }
+    }
+}
+
+// nothing after an unconditional transfer runs until the next label, and a
+// jump to the instruction right after it does nothing. receives branch too
+// but take a value whichever way they go.
+static void removeDeadCode(Optimizer* optimizer) {
+    Assembler* assembler = optimizer->assembler;
+    for(int i = 0; i < assembler->instructionCount; i++) {
+        Instruction* instruction = &assembler->instructions[i];
+        if(optimizer->removed[i]) continue;
+
+        ControlFlow flow = instructionInfo[instruction->opcode].flow;
+        bool receives = instruction->opcode == OP_RECV || instruction->opcode == OP_TRYRECV;
+        if((flow == FLOW_JUMP || flow == FLOW_BRANCH) && !receives &&
+                instruction->label != NULL && labelTarget(optimizer, instruction->label) == i + 1) {
+            removeInstruction(optimizer, i);
+            continue;
+        }
+
+        if(!endsBlock(instruction->opcode)) continue;
+        for(int j = i + 1; j < assembler->instructionCount && !optimizer->labeled[j]; j++)
+            removeInstruction(optimizer, j);
+    }
+}
+
+static bool foldStack(uint8_t opcode, uint16_t a, uint16_t b, uint16_t* result) {
+    switch(opcode) {
+        case OP_ADDS: *result = a + b; return true;
+        case OP_SUBS: *result = a - b; return true;
+        case OP_MULS: *result = a * b; return true;
+        case OP_DIVS:
+            // the vm stops on a zero operand, leave that to happen at run time
+            if(a == 0 || b == 0) return false;
+            *result = a / b;
+            return true;
+        case OP_SHLS: *result = b < 16 ? (uint16_t)(a << b) : 0; return true;
+        case OP_SHRS: *result = b < 16 ? (uint16_t)(a >> b) : 0; return true;
+        case OP_LTS: *result = a < b ? 1 : 0; return true;
+        case OP_GTS: *result = a > b ? 1 : 0; return true;
+        default: return false;
+    }
+}
+
+// stack arithmetic on constants and push/pop pairs that only move a value
+static void rewriteStack(Optimizer* optimizer) {
+    Assembler* assembler = optimizer->assembler;
+    for(int i = 0; i + 1 < assembler->instructionCount; i++) {
+        if(optimizer->removed[i] || optimizer->removed[i + 1] || optimizer->labeled[i + 1]) continue;
+        Instruction* first = &assembler->instructions[i];
+        Instruction* second = &assembler->instructions[i + 1];
+
+        if(first->opcode == OP_PUSH && second->opcode == OP_PUSH && i + 2 < assembler->instructionCount &&
+                !optimizer->removed[i + 2] && !optimizer->labeled[i + 2]) {
+            uint16_t result;
+            if(foldStack(assembler->instructions[i + 2].opcode, first->value, second->value, &result)) {
+                first->value = result;
+                removeInstruction(optimizer, i + 1);
+                removeInstruction(optimizer, i + 2);
+                i += 2;
+            }
+            continue;
+        }
+
+        if(second->opcode != OP_POP) continue;
+        if(first->opcode == OP_PUSH) {
+            first->opcode = OP_SETR;
+            first->reg1 = second->reg1;
+            removeInstruction(optimizer, i + 1);
+            i++;
+        } else if(first->opcode == OP_PUSHR) {
+            if(first->reg1 == second->reg1) {
+                removeInstruction(optimizer, i);
+            } else {
+                first->opcode = OP_MOV;
+                first->reg2 = first->reg1;
+                first->reg1 = second->reg1;
+            }
+            removeInstruction(optimizer, i + 1);
+            i++;
+        }
+    }
+}
+
+// register constants are tracked through a basic block, loading a value a
+// register is known to hold already is dropped
+static void removeRedundantLoads(Optimizer* optimizer) {
+    Assembler* assembler = optimizer->assembler;
+    bool known[NUM_REGS];
+    uint16_t values[NUM_REGS];
+    memset(known, 0, sizeof(known));
+
+    for(int i = 0; i < assembler->instructionCount; i++) {
+        if(optimizer->labeled[i]) memset(known, 0, sizeof(known));
+        if(optimizer->removed[i]) continue;
+
+        Instruction* instruction = &assembler->instructions[i];
+        switch(instruction->opcode) {
+            case OP_SETR:
+                if(known[instruction->reg1] && values[instruction->reg1] == instruction->value) {
+                    removeInstruction(optimizer, i);
+                } else {
+                    known[instruction->reg1] = true;
+                    values[instruction->reg1] = instruction->value;
+                }
+                break;
+            case OP_MOV: {
+                uint8_t dest = instruction->reg1;
+                uint8_t src = instruction->reg2;
+                if(dest == src || (known[dest] && known[src] && values[dest] == values[src])) {
+                    removeInstruction(optimizer, i);
+                } else {
+                    known[dest] = known[src];
+                    values[dest] = values[src];
+                }
+                break;
+            }
+            case OP_PRINTC:
+            case OP_PRINTI:
+            case OP_PRINTH:
+            case OP_PUSHR:
+            case OP_STS:
+            case OP_ST:
+            case OP_SEND:
+            case OP_JNZ:
+            case OP_JZ:
+                break;
+            case OP_SPAWN:
+            case OP_RECV:
+            case OP_TRYRECV:
+                known[instruction->reg1] = false;
+                break;
+            case OP_CAS:
+                known[ax] = false;
+                break;
+            // the window puts r0-r10 back, only the shared registers can change
+            case OP_CALLW:
+                known[ax] = known[bx] = known[cx] = known[dx] = false;
+                break;
+            case OP_CALL:
+            case OP_SYS:
+            case OP_JMP:
+            case OP_RET:
+            case OP_RETW:
+            case OP_HALT:
+                memset(known, 0, sizeof(known));
+                break;
+            default:
+                switch(instructionInfo[instruction->opcode].layout) {
+                    case LAYOUT_REG:
+                    case LAYOUT_REG_REG:
+                    case LAYOUT_REG_IMM:
+                        known[instruction->reg1] = false;
+                        break;
+                    default:
+                        break;
+                }
+                break;
+        }
+    }
+}
+
+// drop removed instructions and move each label to the first instruction kept
+// at or after its old position
+static void compact(Optimizer* optimizer) {
+    Assembler* assembler = optimizer->assembler;
+    int* remap = malloc(sizeof(int) * (assembler->instructionCount + 1));
+    if(remap == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    int count = 0;
+    for(int i = 0; i < assembler->instructionCount; i++) {
+        remap[i] = count;
+        if(!optimizer->removed[i])
+            assembler->instructions[count++] = assembler->instructions[i];
+    }
+    remap[assembler->instructionCount] = count;
+
+    for(int i = 0; i < assembler->labels.capacity; i++) {
+        Entry* entry = &assembler->labels.entries[i];
+        if(entry->key != NULL && entry->defined)
+            entry->value = remap[entry->value];
+    }
+
+    assembler->instructionCount = count;
+    free(remap);
+}
+
+void optimizeInstructions(Assembler* assembler, const char* path) {
+    if(!isRelocatable(assembler)) {
+        fprintf(stderr, "%s: uses numeric addresses or getip, not optimizing.\n", path);
+        return;
+    }
+
+    Optimizer optimizer;
+    optimizer.assembler = assembler;
+    optimizer.labeled = malloc(sizeof(bool) * (assembler->instructionCount + 1));
+    optimizer.removed = malloc(sizeof(bool) * (assembler->instructionCount + 1));
+    if(optimizer.labeled == NULL || optimizer.removed == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    // each pass can expose work for the others, so run them until nothing changes
+    do {
+        optimizer.changed = false;
+
+        markLabels(&optimizer);
+        threadJumps(&optimizer);
+        removeDeadCode(&optimizer);
+        compact(&optimizer);
+
+        markLabels(&optimizer);
+        rewriteStack(&optimizer);
+        compact(&optimizer);
+
+        markLabels(&optimizer);
+        removeRedundantLoads(&optimizer);
+        compact(&optimizer);
+    } while(optimizer.changed);
+
+    free(optimizer.labeled);
+    free(optimizer.removed);
+}
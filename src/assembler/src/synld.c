@@ -0,0 +1,51 @@
+#include <getopt.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "object.h"
+
+static void print_usage(char** argv) {
+    fprintf(stderr, "usage: %s [-o out] [object...]\n", argv[0]);
+}
+
+int main(int argc, char** argv) {
+    char* output = "a.out";
+
+    int opt;
+    while((opt = getopt(argc, argv, "o:")) != -1) {
+        switch(opt) {
+            case 'o': output = optarg; break;
+            default:
+                print_usage(argv);
+                return 1;
+        }
+    }
+
+    if(optind >= argc) {
+        fprintf(stderr, "%s: \e[31;1mfatal error\e[0m: no input files specified\n", argv[0]);
+        print_usage(argv);
+        return 1;
+    }
+
+    int count = argc - optind;
+    Object* objects = malloc(sizeof(Object) * count);
+    if(objects == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        return 1;
+    }
+
+    for(int i = 0; i < count; i++) {
+        if(!readObject(argv[optind + i], &objects[i]))
+            return 1;
+    }
+
+    Image image;
+    linkObjects(objects, count, &image);
+    writeImage(output, &image);
+
+    for(int i = 0; i < count; i++)
+        freeObject(&objects[i]);
+    free(image.pool);
+    free(objects);
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+
+#include "table.h"
+
+uint32_t hashString(const char* chars, int length) {
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < length; i++) {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+void initTable(Table* table) {
+    table->count = 0;
+    table->capacity = 0;
+    table->entries = NULL;
+}
+
+void freeTable(Table* table) {
+    free(table->entries);
+    initTable(table);
+}
+
+void freeSymbols(Table* strings) {
+    for(int i = 0; i < strings->capacity; i++)
+        free(strings->entries[i].key);
+    freeTable(strings);
+}
+
+// capacity is always a power of two so probing can mask instead of divide
+static Entry* findEntry(Entry* entries, int capacity, Symbol* key) {
+    uint32_t index = key->hash & (capacity - 1);
+    for(;;) {
+        Entry* entry = &entries[index];
+        if(entry->key == key || entry->key == NULL) return entry;
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void adjustCapacity(Table* table, int capacity) {
+    Entry* entries = calloc(capacity, sizeof(Entry));
+    if(entries == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    for(int i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        if(entry->key == NULL) continue;
+        *findEntry(entries, capacity, entry->key) = *entry;
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+Entry* tableGet(Table* table, Symbol* key) {
+    if(table->count == 0) return NULL;
+
+    Entry* entry = findEntry(table->entries, table->capacity, key);
+    if(entry->key == NULL) return NULL;
+    return entry;
+}
+
+Entry* tableSet(Table* table, Symbol* key, uint32_t value) {
+    if(table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+        adjustCapacity(table, table->capacity < 8 ? 8 : table->capacity * 2);
+
+    Entry* entry = findEntry(table->entries, table->capacity, key);
+    if(entry->key == NULL) {
+        table->count++;
+        entry->key = key;
+        entry->defined = false;
+    }
+    entry->value = value;
+    return entry;
+}
+
+Symbol* internSymbol(Table* strings, const char* chars, int length, uint32_t hash) {
+    if(strings->count != 0) {
+        uint32_t index = hash & (strings->capacity - 1);
+        for(;;) {
+            Entry* entry = &strings->entries[index];
+            if(entry->key == NULL) break;
+            if(entry->key->hash == hash && entry->key->length == length &&
+                    memcmp(entry->key->chars, chars, length) == 0)
+                return entry->key;
+            index = (index + 1) & (strings->capacity - 1);
+        }
+    }
+
+    Symbol* symbol = malloc(sizeof(Symbol) + length + 1);
+    if(symbol == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    symbol->hash = hash;
+    symbol->length = length;
+    memcpy(symbol->chars, chars, length);
+    symbol->chars[length] = '\0';
+
+    tableSet(strings, symbol, 0);
+    return symbol;
+}
@@ -0,0 +1,206 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "batch.h"
+#include "vm.h"
+
+// the image is loaded once, every record only costs the instructions it runs
+
+typedef struct {
+    uint8_t* data;              // every record of the block, back to back
+    size_t size;
+    size_t capacity;
+    size_t* offsets;
+    uint16_t* lengths;
+    int count;
+} Records;
+
+typedef struct {
+    char* output;
+    size_t size;
+} Chunk;
+
+typedef struct {
+    uint8_t* image;
+    Records* records;
+    size_t first;               // number of the block's first record
+    Chunk* chunks;
+    int chunkCount;
+    atomic_int next;
+} Block;
+
+static void* growArray(void* array, size_t size) {
+    void* result = realloc(array, size);
+    if(result == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    return result;
+}
+
+static void addRecord(Records* records, const uint8_t* bytes, size_t length, size_t number) {
+    if(length > BATCH_RECORD_MAX) {
+        fprintf(stderr, "record %zu is %zu bytes, batch records hold at most %d.\n", number, length, BATCH_RECORD_MAX);
+        exit(1);
+    }
+    if(records->size + length > records->capacity) {
+        records->capacity = (records->size + length) * 2;
+        records->data = growArray(records->data, records->capacity);
+    }
+    memcpy(records->data + records->size, bytes, length);
+    records->offsets[records->count] = records->size;
+    records->lengths[records->count] = (uint16_t)length;
+    records->size += length;
+    records->count++;
+}
+
+// fills the block with up to BATCH_BLOCK records, first is the number of the
+// next record in the whole input
+static int readRecords(FILE* input, RecordFormat format, Records* records, size_t first) {
+    records->size = 0;
+    records->count = 0;
+
+    if(format == RECORDS_LINES) {
+        static char* line = NULL;
+        static size_t lineCapacity = 0;
+        ssize_t length;
+        while(records->count < BATCH_BLOCK && (length = getline(&line, &lineCapacity, input)) != -1) {
+            if(length > 0 && line[length - 1] == '\n') length--;
+            addRecord(records, (uint8_t*)line, (size_t)length, first + records->count);
+        }
+        return records->count;
+    }
+
+    uint8_t bytes[BATCH_RECORD_MAX];
+    while(records->count < BATCH_BLOCK) {
+        uint8_t header[2];
+        size_t got = fread(header, 1, sizeof(header), input);
+        if(got == 0) break;
+        size_t number = first + records->count;
+        size_t length = (size_t)((header[0] << 8) | header[1]);
+        if(got < sizeof(header) || length > BATCH_RECORD_MAX || fread(bytes, 1, length, input) < length) {
+            if(got == sizeof(header) && length > BATCH_RECORD_MAX)
+                fprintf(stderr, "record %zu is %zu bytes, batch records hold at most %d.\n", number, length, BATCH_RECORD_MAX);
+            else
+                fprintf(stderr, "record %zu is cut short.\n", number);
+            exit(1);
+        }
+        addRecord(records, bytes, length, number);
+    }
+    return records->count;
+}
+
+// only the registers, stack and memory are reset, the image and dispatch
+// table are shared by every run. memory is cleared up to the highest word
+// the last record stored to, which for short records is none of it.
+static void runRecord(uint8_t* image, const uint8_t* record, uint16_t length, size_t number) {
+    resetRegisters();
+    memset(vm.stack, 0, sizeof(vm.stack));
+    memset(vm.memory, 0, sizeof(uint16_t) * vm.memoryTop);
+    vm.memoryTop = 0;
+    vm.stackTop = vm.stack;
+    for(int i = length - 1; i >= 0; i--)
+        *vm.stackTop++ = record[i];
+    vm.regs[cx] = length;
+
+    if(run(image) == VM_TRAP) {
+        fflush(vm.out);
+        fprintf(stderr, "record %zu: trap at 0x%04x without a debugger.\n", number, vm.ip);
+        exit(1);
+    }
+    vm.source = NULL;           // not running an image until the next record
+}
+
+// workers take the next chunk of records until none are left, and print
+// into the chunk's own buffer so the output can be put back in order
+static void* batchWorker(void* arg) {
+    Block* block = (Block*)arg;
+    Records* records = block->records;
+    _Atomic uint16_t* memory = vm.memory;
+    vm.memory = calloc(MEMORY_WORDS, sizeof(uint16_t));
+    vm.memoryTop = 0;
+    if(vm.memory == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    for(;;) {
+        int index = atomic_fetch_add(&block->next, 1);
+        if(index >= block->chunkCount) break;
+
+        Chunk* chunk = &block->chunks[index];
+        vm.out = open_memstream(&chunk->output, &chunk->size);
+        if(vm.out == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+        int end = (index + 1) * BATCH_CHUNK;
+        if(end > records->count) end = records->count;
+        for(int i = index * BATCH_CHUNK; i < end; i++)
+            runRecord(block->image, records->data + records->offsets[i], records->lengths[i], block->first + i);
+        fclose(vm.out);
+    }
+    free((void*)vm.memory);
+    vm.memory = memory;
+    return NULL;
+}
+
+static void* batchThread(void* arg) {
+    announceThread(true);
+    batchWorker(arg);
+    announceThread(false);
+    return NULL;
+}
+
+static void runBlock(Block* block, int jobs) {
+    atomic_init(&block->next, 0);
+    if(jobs > block->chunkCount) jobs = block->chunkCount;
+    if(jobs <= 1) {
+        batchWorker(block);
+        return;
+    }
+
+    pthread_t threads[jobs];
+    for(int i = 0; i < jobs; i++) {
+        if(pthread_create(&threads[i], NULL, batchThread, block) != 0) {
+            fprintf(stderr, "error starting batch thread.\n");
+            exit(1);
+        }
+    }
+    for(int i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+}
+
+int runBatch(uint8_t* image, FILE* input, RecordFormat format, int jobs) {
+    Records records;
+    records.data = NULL;
+    records.size = 0;
+    records.capacity = 0;
+    records.offsets = growArray(NULL, sizeof(size_t) * BATCH_BLOCK);
+    records.lengths = growArray(NULL, sizeof(uint16_t) * BATCH_BLOCK);
+
+    Block block;
+    block.image = image;
+    block.records = &records;
+    block.chunks = growArray(NULL, sizeof(Chunk) * (BATCH_BLOCK / BATCH_CHUNK));
+
+    FILE* out = vm.out;
+    size_t first = 1;           // records are numbered from 1 like lines
+    while(readRecords(input, format, &records, first) > 0) {
+        block.first = first;
+        block.chunkCount = (records.count + BATCH_CHUNK - 1) / BATCH_CHUNK;
+        runBlock(&block, jobs);
+
+        for(int i = 0; i < block.chunkCount; i++) {
+            fwrite(block.chunks[i].output, 1, block.chunks[i].size, out);
+            free(block.chunks[i].output);
+        }
+        first += records.count;
+    }
+    vm.out = out;
+
+    free(records.data);
+    free(records.offsets);
+    free(records.lengths);
+    free(block.chunks);
+    return 0;
+}
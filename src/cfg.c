@@ -0,0 +1,602 @@
+#include <limits.h>
+#include <stdio.h>
+
+#include "cfg.h"
+#include "opcodes.h"
+#include "vm.h"
+
+#define UNSET INT_MIN
+
+static void* allocate(size_t size) {
+    void* pointer = calloc(1, size > 0 ? size : 1);
+    if(pointer == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    return pointer;
+}
+
+static uint32_t nextInstruction(ControlFlowGraph* graph, uint32_t address) {
+    return address + instructionLength(graph->source, (int)address, (int)graph->length);
+}
+
+static uint16_t getOperand16(const uint8_t* source, uint32_t offset) {
+    return (uint16_t)((source[offset] << 8) | source[offset + 1]);
+}
+
+// where a jump, branch or call goes, -1 for anything else
+static int32_t branchTarget(ControlFlowGraph* graph, uint32_t address, uint32_t next) {
+    const uint8_t* source = graph->source;
+    if(next > graph->length) return -1; // operand cut off by the end of the image
+    OperandLayout layout = instructionInfo[source[address]].layout;
+    if(addressOffset(layout)) return getOperand16(source, address + addressOffset(layout));
+    switch(layout) {
+        case LAYOUT_REL: return (uint16_t)(next + (int8_t)source[address + 1]);
+        case LAYOUT_REG_REL: return (uint16_t)(next + (int8_t)source[address + 2]);
+        default: return -1;
+    }
+}
+
+// unknown opcodes end execution as far as the graph is concerned
+static ControlFlow flowOf(ControlFlowGraph* graph, uint32_t address) {
+    const InstructionInfo* info = &instructionInfo[graph->source[address]];
+    return info->mnemonic == NULL ? FLOW_STOP : info->flow;
+}
+
+int findBlock(ControlFlowGraph* graph, uint32_t address) {
+    int low = 0;
+    int high = graph->blockCount;
+    if(high == 0 || address < graph->blocks[0].start) return -1;
+    while(high - low > 1) {
+        int middle = low + (high - low) / 2;
+        if(graph->blocks[middle].start <= address) low = middle;
+        else high = middle;
+    }
+    return address < graph->blocks[low].end ? low : -1;
+}
+
+static int findFunction(ControlFlowGraph* graph, uint32_t entry) {
+    int low = 0;
+    int high = graph->functionCount;
+    while(low < high) {
+        int middle = low + (high - low) / 2;
+        if(graph->functions[middle].entry == entry) return middle;
+        if(graph->functions[middle].entry < entry) low = middle + 1;
+        else high = middle;
+    }
+    return -1;
+}
+
+// leaders are the first instruction, every jump and branch target and every
+// instruction following a jump, branch, return or stop
+static void findBlocks(ControlFlowGraph* graph, bool* starts, bool* leaders, bool* entries) {
+    uint32_t length = graph->length;
+    for(uint32_t address = 0; address < length; address = nextInstruction(graph, address))
+        starts[address] = true;
+
+    leaders[0] = length > 0;
+    for(uint32_t address = 0; address < length;) {
+        uint32_t next = nextInstruction(graph, address);
+        ControlFlow flow = flowOf(graph, address);
+        int32_t target = branchTarget(graph, address, next);
+        bool validTarget = target >= 0 && (uint32_t)target < length && starts[target];
+
+        if(flow == FLOW_JUMP || flow == FLOW_BRANCH) {
+            if(validTarget) leaders[target] = true;
+        } else if((flow == FLOW_CALL || flow == FLOW_SPAWN) && validTarget) {
+            leaders[target] = true;
+            entries[target] = true;
+        }
+        if(flow != FLOW_NEXT && flow != FLOW_CALL && flow != FLOW_SPAWN && next < length)
+            leaders[next] = true;
+        address = next;
+    }
+
+    // the image starts with `jmp main`, main is the function that runs first
+    if(length >= 3 && graph->source[0] == OP_JMP) {
+        uint16_t main = getOperand16(graph->source, 1);
+        if(main < length && starts[main]) entries[main] = true;
+    } else if(length > 0) {
+        entries[0] = true;
+    }
+
+    int capacity = 0;
+    for(uint32_t address = 0; address < length;) {
+        if(graph->blockCount + 1 > capacity) {
+            capacity = capacity < 8 ? 8 : capacity * 2;
+            graph->blocks = realloc(graph->blocks, sizeof(BasicBlock) * capacity);
+            if(graph->blocks == NULL) {
+                fprintf(stderr, "out of memory.\n");
+                exit(1);
+            }
+        }
+
+        BasicBlock* block = &graph->blocks[graph->blockCount++];
+        block->start = address;
+        block->instructions = 0;
+        block->successors[0] = -1;
+        block->successors[1] = -1;
+        for(;;) {
+            uint32_t next = nextInstruction(graph, address);
+            block->instructions++;
+            ControlFlow flow = flowOf(graph, address);
+            bool ends = flow != FLOW_NEXT && flow != FLOW_CALL && flow != FLOW_SPAWN;
+            address = next;
+            if(ends || address >= length || leaders[address]) break;
+        }
+        block->end = address < length ? address : length;
+    }
+}
+
+static void linkBlocks(ControlFlowGraph* graph) {
+    for(int i = 0; i < graph->blockCount; i++) {
+        BasicBlock* block = &graph->blocks[i];
+
+        // the last instruction decides where the block goes
+        uint32_t last = block->start;
+        for(uint32_t address = block->start; address < block->end; address = nextInstruction(graph, address))
+            last = address;
+
+        ControlFlow flow = flowOf(graph, last);
+        int32_t target = branchTarget(graph, last, block->end);
+        int targetBlock = target >= 0 ? findBlock(graph, (uint32_t)target) : -1;
+        if(targetBlock >= 0 && graph->blocks[targetBlock].start != (uint32_t)target) targetBlock = -1;
+        int nextBlock = block->end < graph->length ? i + 1 : -1;
+
+        switch(flow) {
+            case FLOW_NEXT:
+            case FLOW_CALL:
+            case FLOW_SPAWN:
+                block->successors[0] = nextBlock;
+                break;
+            case FLOW_JUMP:
+                block->successors[0] = targetBlock;
+                break;
+            case FLOW_BRANCH:
+                block->successors[0] = nextBlock;
+                block->successors[1] = targetBlock != nextBlock ? targetBlock : -1;
+                break;
+            case FLOW_RETURN:
+            case FLOW_STOP:
+                break;
+        }
+    }
+}
+
+static int intersect(int* dominators, int a, int b) {
+    while(a != b) {
+        while(a > b) a = dominators[a];
+        while(b > a) b = dominators[b];
+    }
+    return a;
+}
+
+static bool dominates(int* dominators, int dominator, int position) {
+    for(;;) {
+        if(position == dominator) return true;
+        if(position == 0) return false;
+        position = dominators[position];
+    }
+}
+
+// stamp and position are indexed by block, a block belongs to the function
+// being built when its stamp matches
+typedef struct {
+    int* stamp;
+    int* position;
+    int* stack;
+    int* edge;
+    bool* marked;
+} Scratch;
+
+// blocks reachable from the entry without following calls, in reverse postorder
+static void orderBlocks(ControlFlowGraph* graph, Function* function, int id, Scratch* scratch) {
+    int entry = findBlock(graph, function->entry);
+    int* postorder = allocate(sizeof(int) * graph->blockCount);
+    int count = 0;
+    int depth = 0;
+
+    scratch->stamp[entry] = id;
+    scratch->stack[depth] = entry;
+    scratch->edge[depth++] = 0;
+    while(depth > 0) {
+        int block = scratch->stack[depth - 1];
+        int edge = scratch->edge[depth - 1]++;
+        if(edge < 2) {
+            int successor = graph->blocks[block].successors[edge];
+            if(successor >= 0 && scratch->stamp[successor] != id) {
+                scratch->stamp[successor] = id;
+                scratch->stack[depth] = successor;
+                scratch->edge[depth++] = 0;
+            }
+            continue;
+        }
+        postorder[count++] = block;
+        depth--;
+    }
+
+    function->blocks = allocate(sizeof(int) * count);
+    function->blockCount = count;
+    for(int i = 0; i < count; i++) {
+        function->blocks[i] = postorder[count - 1 - i];
+        scratch->position[function->blocks[i]] = i;
+    }
+    free(postorder);
+}
+
+// Cooper, Harvey and Kennedy's iterative algorithm over reverse postorder
+static void findDominators(ControlFlowGraph* graph, Function* function, int id, Scratch* scratch) {
+    int count = function->blockCount;
+    int* predecessorCount = allocate(sizeof(int) * (count + 1));
+    for(int i = 0; i < count; i++) {
+        BasicBlock* block = &graph->blocks[function->blocks[i]];
+        for(int j = 0; j < 2; j++)
+            if(block->successors[j] >= 0 && scratch->stamp[block->successors[j]] == id)
+                predecessorCount[scratch->position[block->successors[j]] + 1]++;
+    }
+    for(int i = 0; i < count; i++)
+        predecessorCount[i + 1] += predecessorCount[i];
+
+    int* predecessors = allocate(sizeof(int) * (predecessorCount[count] + 1));
+    int* fill = allocate(sizeof(int) * (count + 1));
+    for(int i = 0; i < count; i++) {
+        BasicBlock* block = &graph->blocks[function->blocks[i]];
+        for(int j = 0; j < 2; j++) {
+            if(block->successors[j] < 0 || scratch->stamp[block->successors[j]] != id) continue;
+            int successor = scratch->position[block->successors[j]];
+            predecessors[predecessorCount[successor] + fill[successor]++] = i;
+        }
+    }
+
+    int* dominators = allocate(sizeof(int) * count);
+    for(int i = 0; i < count; i++) dominators[i] = -1;
+    dominators[0] = 0;
+
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(int i = 1; i < count; i++) {
+            int dominator = -1;
+            for(int j = predecessorCount[i]; j < predecessorCount[i + 1]; j++) {
+                int predecessor = predecessors[j];
+                if(dominators[predecessor] < 0) continue;
+                dominator = dominator < 0 ? predecessor : intersect(dominators, predecessor, dominator);
+            }
+            if(dominator != dominators[i]) {
+                dominators[i] = dominator;
+                changed = true;
+            }
+        }
+    }
+
+    function->dominators = dominators;
+    free(predecessorCount);
+    free(predecessors);
+    free(fill);
+}
+
+static Loop* loopFor(Function* function, int header, int* capacity) {
+    for(int i = 0; i < function->loopCount; i++)
+        if(function->loops[i].header == header) return &function->loops[i];
+
+    if(function->loopCount + 1 > *capacity) {
+        *capacity = *capacity < 8 ? 8 : *capacity * 2;
+        function->loops = realloc(function->loops, sizeof(Loop) * *capacity);
+        if(function->loops == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+    }
+    Loop* loop = &function->loops[function->loopCount++];
+    loop->header = header;
+    loop->blocks = NULL;
+    loop->blockCount = 0;
+    return loop;
+}
+
+// a back edge goes to a block that dominates its source, the natural loop is
+// the header and everything that reaches the source without passing the header
+static void findLoops(ControlFlowGraph* graph, Function* function, int id, Scratch* scratch) {
+    int capacity = 0;
+    int* members = allocate(sizeof(int) * function->blockCount);
+
+    for(int i = 0; i < function->blockCount; i++) {
+        BasicBlock* block = &graph->blocks[function->blocks[i]];
+        for(int j = 0; j < 2; j++) {
+            int successor = block->successors[j];
+            if(successor < 0 || scratch->stamp[successor] != id) continue;
+            int header = scratch->position[successor];
+            if(header > i || !dominates(function->dominators, header, i)) continue;
+
+            Loop* loop = loopFor(function, successor, &capacity);
+            memset(scratch->marked, 0, sizeof(bool) * function->blockCount);
+            int count = 0;
+            for(int k = 0; k < loop->blockCount; k++) {
+                scratch->marked[scratch->position[loop->blocks[k]]] = true;
+                members[count++] = scratch->position[loop->blocks[k]];
+            }
+            if(!scratch->marked[header]) {
+                scratch->marked[header] = true;
+                members[count++] = header;
+            }
+
+            // walk predecessors backwards from the source of the back edge
+            int depth = 0;
+            if(!scratch->marked[i]) {
+                scratch->marked[i] = true;
+                members[count++] = i;
+                scratch->stack[depth++] = i;
+            }
+            while(depth > 0) {
+                int position = scratch->stack[--depth];
+                for(int k = 0; k < function->blockCount; k++) {
+                    if(scratch->marked[k]) continue;
+                    BasicBlock* candidate = &graph->blocks[function->blocks[k]];
+                    if(candidate->successors[0] == function->blocks[position] ||
+                            candidate->successors[1] == function->blocks[position]) {
+                        scratch->marked[k] = true;
+                        members[count++] = k;
+                        scratch->stack[depth++] = k;
+                    }
+                }
+            }
+
+            free(loop->blocks);
+            loop->blocks = allocate(sizeof(int) * count);
+            loop->blockCount = count;
+            for(int k = 0; k < count; k++)
+                loop->blocks[k] = function->blocks[members[k]];
+        }
+    }
+    free(members);
+}
+
+void buildGraph(ControlFlowGraph* graph, const uint8_t* source, uint32_t length) {
+    memset(graph, 0, sizeof(ControlFlowGraph));
+    graph->source = source;
+    graph->length = length;
+
+    // the string pool is data, the graph ends where it starts
+    for(uint32_t address = 0; address < graph->length; address = nextInstruction(graph, address)) {
+        if(source[address] == OP_POOL) {
+            length = graph->length = address;
+            break;
+        }
+    }
+
+    bool* starts = allocate(sizeof(bool) * (length + 1));
+    bool* leaders = allocate(sizeof(bool) * (length + 1));
+    bool* entries = allocate(sizeof(bool) * (length + 1));
+    findBlocks(graph, starts, leaders, entries);
+    linkBlocks(graph);
+
+    for(uint32_t address = 0; address < length; address++)
+        if(entries[address]) graph->functionCount++;
+    graph->functions = allocate(sizeof(Function) * graph->functionCount);
+    int index = 0;
+    for(uint32_t address = 0; address < length; address++)
+        if(entries[address]) graph->functions[index++].entry = address;
+
+    Scratch scratch;
+    scratch.stamp = allocate(sizeof(int) * graph->blockCount);
+    scratch.position = allocate(sizeof(int) * graph->blockCount);
+    scratch.stack = allocate(sizeof(int) * graph->blockCount);
+    scratch.edge = allocate(sizeof(int) * graph->blockCount);
+    scratch.marked = allocate(sizeof(bool) * graph->blockCount);
+    for(int i = 0; i < graph->blockCount; i++) scratch.stamp[i] = -1;
+
+    for(int i = 0; i < graph->functionCount; i++) {
+        Function* function = &graph->functions[i];
+        orderBlocks(graph, function, i, &scratch);
+        findDominators(graph, function, i, &scratch);
+        findLoops(graph, function, i, &scratch);
+    }
+
+    free(scratch.stamp);
+    free(scratch.position);
+    free(scratch.stack);
+    free(scratch.edge);
+    free(scratch.marked);
+    free(starts);
+    free(leaders);
+    free(entries);
+}
+
+void freeGraph(ControlFlowGraph* graph) {
+    for(int i = 0; i < graph->functionCount; i++) {
+        Function* function = &graph->functions[i];
+        for(int j = 0; j < function->loopCount; j++)
+            free(function->loops[j].blocks);
+        free(function->loops);
+        free(function->blocks);
+        free(function->dominators);
+    }
+    free(graph->functions);
+    free(graph->blocks);
+    memset(graph, 0, sizeof(ControlFlowGraph));
+}
+
+enum { UNVISITED, IN_PROGRESS, DONE };
+
+static void analyzeFunction(ControlFlowGraph* graph, int index);
+
+// walk the instructions of a block from the given stack depth, returning the
+// depth it leaves with. the block's cost includes everything it calls.
+static int walkBlock(ControlFlowGraph* graph, Function* function, BasicBlock* block, int depth, uint32_t* cost) {
+    *cost = block->instructions;
+    for(uint32_t address = block->start; address < block->end;) {
+        uint32_t next = nextInstruction(graph, address);
+        const InstructionInfo* info = &instructionInfo[graph->source[address]];
+
+        if(info->flow == FLOW_CALL) {
+            int32_t target = branchTarget(graph, address, next);
+            int callee = target >= 0 ? findFunction(graph, (uint32_t)target) : -1;
+            if(callee >= 0) {
+                analyzeFunction(graph, callee);
+                Function* called = &graph->functions[callee];
+                if(called->state == IN_PROGRESS) function->recursive = true;
+                function->recursive |= called->recursive;
+                function->usesHost |= called->usesHost;
+                function->stackUnbounded |= called->stackUnbounded;
+                // a return address pushed by the call stays on the stack for
+                // the whole call, callw keeps its own in the window bank
+                if(depth + info->pushes + called->maxStack > function->maxStack)
+                    function->maxStack = depth + info->pushes + called->maxStack;
+                *cost += called->cost;
+            }
+        } else if(info->flow == FLOW_RETURN) {
+            // pops the caller's return address if any, not part of this frame
+        } else if(info->pops == STACK_VARIES) {
+            function->usesHost = true;
+        } else if(info->mnemonic != NULL) {
+            depth += info->pushes - info->pops;
+            if(depth > function->maxStack) function->maxStack = depth;
+        }
+        address = next;
+    }
+    return depth;
+}
+
+// stack depths flow forward through the blocks, a merge keeps the deeper one.
+// costs are the longest path through the blocks with loop back edges removed.
+static void analyzeFunction(ControlFlowGraph* graph, int index) {
+    Function* function = &graph->functions[index];
+    if(function->state != UNVISITED) return;
+    function->state = IN_PROGRESS;
+
+    int count = function->blockCount;
+    int* depthIn = allocate(sizeof(int) * count);
+    uint32_t* blockCost = allocate(sizeof(uint32_t) * count);
+    uint64_t* pathCost = allocate(sizeof(uint64_t) * count);
+    int* position = allocate(sizeof(int) * graph->blockCount);
+    for(int i = 0; i < graph->blockCount; i++) position[i] = -1;
+    for(int i = 0; i < count; i++) {
+        depthIn[i] = UNSET;
+        position[function->blocks[i]] = i;
+    }
+    depthIn[0] = 0;
+
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(int i = 0; i < count; i++) {
+            if(depthIn[i] == UNSET) continue;
+            BasicBlock* block = &graph->blocks[function->blocks[i]];
+            int depth = walkBlock(graph, function, block, depthIn[i], &blockCost[i]);
+            for(int j = 0; j < 2; j++) {
+                int successor = block->successors[j] >= 0 ? position[block->successors[j]] : -1;
+                if(successor < 0 || (depthIn[successor] != UNSET && depthIn[successor] >= depth)) continue;
+                if(depth > STACK_MAX) {
+                    function->stackUnbounded = true;
+                    continue;
+                }
+                depthIn[successor] = depth;
+                changed = true;
+            }
+        }
+    }
+
+    uint64_t cost = 0;
+    for(int i = 0; i < count; i++) {
+        pathCost[i] += blockCost[i];
+        if(pathCost[i] > cost) cost = pathCost[i];
+        BasicBlock* block = &graph->blocks[function->blocks[i]];
+        for(int j = 0; j < 2; j++) {
+            int successor = block->successors[j] >= 0 ? position[block->successors[j]] : -1;
+            if(successor > i && pathCost[i] > pathCost[successor])
+                pathCost[successor] = pathCost[i];
+        }
+    }
+    function->cost = cost > UINT32_MAX ? UINT32_MAX : (uint32_t)cost;
+
+    free(depthIn);
+    free(blockCost);
+    free(pathCost);
+    free(position);
+    function->state = DONE;
+}
+
+void analyzeFunctions(ControlFlowGraph* graph) {
+    for(int i = 0; i < graph->functionCount; i++)
+        analyzeFunction(graph, i);
+}
+
+void printFunctionName(FILE* file, ControlFlowGraph* graph, uint32_t address, DebugInfo* info) {
+    if(info != NULL) {
+        const DebugLabel* label = lookupLabel(info, address);
+        if(label != NULL && label->address == address) {
+            fprintf(file, "%s", label->name);
+            return;
+        }
+    }
+    if(graph->length >= 3 && graph->source[0] == OP_JMP && getOperand16(graph->source, 1) == address)
+        fprintf(file, "main");
+    else
+        fprintf(file, "sub_%04x", address);
+}
+
+static void writeNode(FILE* file, ControlFlowGraph* graph, int index, bool header) {
+    BasicBlock* block = &graph->blocks[index];
+    fprintf(file, "    b%d [label=\"0x%04x..0x%04x\\n%u instruction%s\"%s];\n", index, block->start,
+        block->end, block->instructions, block->instructions == 1 ? "" : "s", header ? ", style=bold" : "");
+}
+
+// one cluster per function, a block shared by functions is drawn in the first
+void writeDot(ControlFlowGraph* graph, FILE* file, DebugInfo* info) {
+    int* owner = allocate(sizeof(int) * graph->blockCount);
+    bool* header = allocate(sizeof(bool) * graph->blockCount);
+    for(int i = 0; i < graph->blockCount; i++) owner[i] = -1;
+    for(int i = 0; i < graph->functionCount; i++) {
+        Function* function = &graph->functions[i];
+        for(int j = 0; j < function->blockCount; j++)
+            if(owner[function->blocks[j]] < 0) owner[function->blocks[j]] = i;
+        for(int j = 0; j < function->loopCount; j++)
+            header[function->loops[j].header] = true;
+    }
+
+    fprintf(file, "digraph cfg {\n");
+    fprintf(file, "    node [shape=box, fontname=\"monospace\"];\n");
+    for(int i = 0; i < graph->functionCount; i++) {
+        Function* function = &graph->functions[i];
+        fprintf(file, "    subgraph cluster_%d {\n        label=\"", i);
+        printFunctionName(file, graph, function->entry, info);
+        fprintf(file, "\";\n");
+        for(int j = 0; j < function->blockCount; j++) {
+            int index = function->blocks[j];
+            if(owner[index] != i) continue;
+            fprintf(file, "    ");
+            writeNode(file, graph, index, header[index]);
+        }
+        fprintf(file, "    }\n");
+    }
+
+    // code only reached through the entry stub or not at all
+    for(int i = 0; i < graph->blockCount; i++)
+        if(owner[i] < 0) writeNode(file, graph, i, false);
+
+    for(int i = 0; i < graph->blockCount; i++) {
+        BasicBlock* block = &graph->blocks[i];
+        for(int j = 0; j < 2; j++) {
+            int successor = block->successors[j];
+            if(successor < 0) continue;
+            bool back = successor <= i && header[successor];
+            fprintf(file, "    b%d -> b%d%s;\n", i, successor, back ? " [color=red]" : "");
+        }
+
+        // calls are drawn dashed to the callee's entry, spawns dotted
+        for(uint32_t address = block->start; address < block->end;) {
+            uint32_t next = nextInstruction(graph, address);
+            ControlFlow flow = instructionInfo[graph->source[address]].flow;
+            if(flow == FLOW_CALL || flow == FLOW_SPAWN) {
+                int32_t target = branchTarget(graph, address, next);
+                int callee = target >= 0 ? findBlock(graph, (uint32_t)target) : -1;
+                if(callee >= 0) fprintf(file, "    b%d -> b%d [style=%s];\n", i, callee, flow == FLOW_CALL ? "dashed" : "dotted");
+            }
+            address = next;
+        }
+    }
+    fprintf(file, "}\n");
+
+    free(owner);
+    free(header);
+}
@@ -0,0 +1,119 @@
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+
+#include "channel.h"
+
+// dmitry vyukov's bounded queue: every cell carries a sequence number that
+// says whether it is ready to be written or read for the current lap, so
+// senders and receivers claim positions with one compare and swap and never
+// take a lock. values move straight from the sender's register into the cell
+// and out into the receiver's.
+
+#define SPINS 64                // busy polls before a waiting thread yields
+
+typedef struct {
+    atomic_size_t sequence;
+    uint16_t value;
+} Cell;
+
+typedef struct {
+    alignas(64) atomic_size_t sendPosition;
+    alignas(64) atomic_size_t receivePosition;
+    atomic_bool closed;
+    alignas(64) Cell cells[CHANNEL_SIZE];
+} Channel;
+
+static Channel channels[CHANNEL_MAX];
+
+void initChannels() {
+    for(int i = 0; i < CHANNEL_MAX; i++) {
+        Channel* channel = &channels[i];
+        atomic_init(&channel->sendPosition, 0);
+        atomic_init(&channel->receivePosition, 0);
+        atomic_init(&channel->closed, false);
+        for(size_t j = 0; j < CHANNEL_SIZE; j++)
+            atomic_init(&channel->cells[j].sequence, j);
+    }
+}
+
+static bool trySend(Channel* channel, uint16_t value) {
+    size_t position = atomic_load_explicit(&channel->sendPosition, memory_order_relaxed);
+    for(;;) {
+        Cell* cell = &channel->cells[position & (CHANNEL_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if(difference == 0) {
+            if(atomic_compare_exchange_weak_explicit(&channel->sendPosition, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                cell->value = value;
+                atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+                return true;
+            }
+        } else if(difference < 0) {
+            return false; // a lap behind, the channel is full
+        } else {
+            position = atomic_load_explicit(&channel->sendPosition, memory_order_relaxed);
+        }
+    }
+}
+
+static bool tryReceive(Channel* channel, uint16_t* value) {
+    size_t position = atomic_load_explicit(&channel->receivePosition, memory_order_relaxed);
+    for(;;) {
+        Cell* cell = &channel->cells[position & (CHANNEL_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if(difference == 0) {
+            if(atomic_compare_exchange_weak_explicit(&channel->receivePosition, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                *value = cell->value;
+                atomic_store_explicit(&cell->sequence, position + CHANNEL_SIZE, memory_order_release);
+                return true;
+            }
+        } else if(difference < 0) {
+            return false; // nothing sent into this cell yet, the channel is empty
+        } else {
+            position = atomic_load_explicit(&channel->receivePosition, memory_order_relaxed);
+        }
+    }
+}
+
+// the fast path never leaves user space, a thread only yields once the other
+// side has fallen behind for a while
+static void backOff(int* spins) {
+    if(++*spins < SPINS) return;
+    *spins = 0;
+    sched_yield();
+}
+
+void channelSend(uint16_t channel, uint16_t value) {
+    int spins = 0;
+    while(!trySend(&channels[channel], value))
+        backOff(&spins);
+}
+
+bool channelReceive(uint16_t channel, uint16_t* value, bool wait) {
+    Channel* ring = &channels[channel];
+    int spins = 0;
+    for(;;) {
+        if(tryReceive(ring, value)) return true;
+        if(atomic_load_explicit(&ring->closed, memory_order_acquire)) break;
+        if(!wait) return false;
+        backOff(&spins);
+    }
+
+    // closed, but a sender may have claimed a cell and not filled it yet.
+    // the channel is only empty once every claimed cell has been received.
+    for(;;) {
+        if(tryReceive(ring, value)) return true;
+        if(atomic_load_explicit(&ring->receivePosition, memory_order_relaxed) ==
+                atomic_load_explicit(&ring->sendPosition, memory_order_relaxed))
+            return false;
+        backOff(&spins);
+    }
+}
+
+void closeChannel(uint16_t channel) {
+    atomic_store_explicit(&channels[channel].closed, true, memory_order_release);
+}
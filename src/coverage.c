@@ -0,0 +1,63 @@
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "cfg.h"
+#include "coverage.h"
+#include "covmap.h"
+#include "opcodes.h"
+#include "vm.h"
+
+typedef struct {
+    const uint8_t* original;
+    uint8_t* code;              // the copy the vm runs, traps on leaders not yet hit
+    ControlFlowGraph graph;
+    CoverageMap map;
+    _Atomic uint8_t* hits;      // one bit per block, set from any thread
+} Coverage;
+
+static Coverage coverage;
+
+// threads racing through the same leader each write the original byte back,
+// and other threads may be running the code, so the byte is stored atomically.
+// it only ever goes from trap to the same instruction
+static bool coverBlock(uint16_t address) {
+    if(address >= coverage.graph.length || coverage.original[address] == OP_TRAP) return false;
+    int block = findBlock(&coverage.graph, address);
+    if(block < 0 || coverage.graph.blocks[block].start != address) return false;
+
+    atomic_fetch_or_explicit(&coverage.hits[block / 8], (uint8_t)(1 << (block % 8)), memory_order_relaxed);
+    atomic_store_explicit((_Atomic uint8_t*)&coverage.code[address], coverage.original[address], memory_order_relaxed);
+    return true;
+}
+
+uint8_t* startCoverage(const uint8_t* image, size_t length) {
+    coverage.original = image;
+    coverage.code = malloc(length + 1);
+    if(coverage.code == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    memcpy(coverage.code, image, length + 1);
+
+    buildGraph(&coverage.graph, image, (uint32_t)length);
+    initCoverageMap(&coverage.map, image, (uint32_t)length, (uint32_t)coverage.graph.blockCount);
+    coverage.hits = calloc((coverage.graph.blockCount + 7) / 8 + 1, sizeof(_Atomic uint8_t));
+    if(coverage.hits == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    // a trap assembled into the image stays a trap and is never counted
+    for(int i = 0; i < coverage.graph.blockCount; i++) {
+        uint32_t start = coverage.graph.blocks[i].start;
+        if(image[start] != OP_TRAP) coverage.code[start] = OP_TRAP;
+    }
+    setTrapHandler(coverBlock);
+    return coverage.code;
+}
+
+bool finishCoverage(const char* path) {
+    for(int i = 0; i < (coverage.graph.blockCount + 7) / 8; i++)
+        coverage.map.bits[i] = atomic_load_explicit(&coverage.hits[i], memory_order_relaxed);
+    return mergeCoverageFile(path, &coverage.map);
+}
@@ -0,0 +1,307 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "covmap.h"
+#include "opcodes.h"
+
+#define LINE_NONE 0             // no instruction came from the line
+#define LINE_MISSED 1
+#define LINE_HIT 2
+
+static uint32_t hashImage(const uint8_t* image, uint32_t length) {
+    uint32_t hash = 2166136261u;
+    for(uint32_t i = 0; i < length; i++) {
+        hash ^= image[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static size_t bitmapSize(uint32_t blockCount) {
+    return (blockCount + 7) / 8;
+}
+
+void initCoverageMap(CoverageMap* map, const uint8_t* image, uint32_t length, uint32_t blockCount) {
+    map->imageLength = length;
+    map->imageHash = hashImage(image, length);
+    map->blockCount = blockCount;
+    map->bits = calloc(bitmapSize(blockCount) + 1, 1);
+    if(map->bits == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+}
+
+void freeCoverageMap(CoverageMap* map) {
+    free(map->bits);
+    memset(map, 0, sizeof(CoverageMap));
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+static bool parseCoverageMap(const uint8_t* data, size_t size, CoverageMap* map) {
+    if(size < COVERAGE_HEADER_SIZE || memcmp(data, COVERAGE_MAGIC, 4) != 0) return false;
+    if(((data[4] << 8) | data[5]) != COVERAGE_VERSION) return false;
+
+    uint32_t blockCount = get32(data + 14);
+    if(size != COVERAGE_HEADER_SIZE + bitmapSize(blockCount)) return false;
+    map->imageLength = get32(data + 6);
+    map->imageHash = get32(data + 10);
+    map->blockCount = blockCount;
+    map->bits = malloc(bitmapSize(blockCount) + 1);
+    if(map->bits == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    memcpy(map->bits, data + COVERAGE_HEADER_SIZE, bitmapSize(blockCount));
+    return true;
+}
+
+static uint8_t* encodeCoverageMap(CoverageMap* map, size_t* size) {
+    *size = COVERAGE_HEADER_SIZE + bitmapSize(map->blockCount);
+    uint8_t* data = malloc(*size);
+    if(data == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    memcpy(data, COVERAGE_MAGIC, 4);
+    data[4] = (uint8_t)(COVERAGE_VERSION >> 8);
+    data[5] = (uint8_t)COVERAGE_VERSION;
+    put32(data + 6, map->imageLength);
+    put32(data + 10, map->imageHash);
+    put32(data + 14, map->blockCount);
+    memcpy(data + COVERAGE_HEADER_SIZE, map->bits, bitmapSize(map->blockCount));
+    return data;
+}
+
+bool readCoverageMap(const char* path, CoverageMap* map) {
+    memset(map, 0, sizeof(CoverageMap));
+
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "coverage file `%s` does not exist.\n", path);
+        return false;
+    }
+
+    fseek(file, 0L, SEEK_END);
+    size_t fileSize = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+
+    uint8_t* data = malloc(fileSize + 1);
+    if(data == NULL || fread(data, 1, fileSize, file) < fileSize) {
+        fprintf(stderr, "error reading coverage file `%s`.\n", path);
+        fclose(file);
+        free(data);
+        return false;
+    }
+    fclose(file);
+
+    bool valid = parseCoverageMap(data, fileSize, map);
+    free(data);
+    if(!valid) fprintf(stderr, "`%s` is not a valid coverage file.\n", path);
+    return valid;
+}
+
+bool writeCoverageMap(const char* path, CoverageMap* map) {
+    FILE* file = fopen(path, "wb");
+    if(file == NULL) {
+        fprintf(stderr, "error opening coverage file `%s`.\n", path);
+        return false;
+    }
+    size_t size;
+    uint8_t* data = encodeCoverageMap(map, &size);
+    bool written = fwrite(data, 1, size, file) == size;
+    free(data);
+    if(fclose(file) != 0 || !written) {
+        fprintf(stderr, "error writing coverage file `%s`.\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool mergeCoverageMap(CoverageMap* map, CoverageMap* from) {
+    if(map->imageLength != from->imageLength || map->imageHash != from->imageHash || map->blockCount != from->blockCount)
+        return false;
+    for(size_t i = 0; i < bitmapSize(map->blockCount); i++)
+        map->bits[i] |= from->bits[i];
+    return true;
+}
+
+bool mergeCoverageFile(const char* path, CoverageMap* map) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0 || flock(fd, LOCK_EX) < 0) {
+        fprintf(stderr, "error opening coverage file `%s`.\n", path);
+        if(fd >= 0) close(fd);
+        return false;
+    }
+
+    struct stat st;
+    bool merged = fstat(fd, &st) == 0;
+    if(merged && st.st_size > 0) {
+        uint8_t* data = malloc(st.st_size);
+        CoverageMap existing;
+        if(data == NULL || pread(fd, data, st.st_size, 0) != st.st_size || !parseCoverageMap(data, st.st_size, &existing)) {
+            fprintf(stderr, "`%s` is not a valid coverage file.\n", path);
+            merged = false;
+        } else {
+            merged = mergeCoverageMap(map, &existing);
+            if(!merged) fprintf(stderr, "coverage file `%s` was written for a different image.\n", path);
+            freeCoverageMap(&existing);
+        }
+        free(data);
+    }
+
+    if(merged) {
+        size_t size;
+        uint8_t* data = encodeCoverageMap(map, &size);
+        merged = pwrite(fd, data, size, 0) == (ssize_t)size && ftruncate(fd, size) == 0;
+        if(!merged) fprintf(stderr, "error writing coverage file `%s`.\n", path);
+        free(data);
+    }
+    close(fd);
+    return merged;
+}
+
+// the state of every line of every file, a line is hit when any instruction
+// assembled from it is in a block that ran
+static uint8_t** collectLines(ControlFlowGraph* graph, CoverageMap* map, DebugInfo* info, uint32_t* lineCounts) {
+    uint8_t** lines = calloc(info->fileCount + 1, sizeof(uint8_t*));
+    if(lines == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    for(uint32_t i = 0; i < info->fileCount; i++) lineCounts[i] = 0;
+    for(uint32_t i = 0; i < info->rowCount; i++) {
+        LineRow* row = &info->rows[i];
+        if(row->file < info->fileCount && row->line >= lineCounts[row->file])
+            lineCounts[row->file] = row->line + 1;
+    }
+    for(uint32_t i = 0; i < info->fileCount; i++) {
+        lines[i] = calloc(lineCounts[i] + 1, 1);
+        if(lines[i] == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+    }
+
+    for(int i = 0; i < graph->blockCount; i++) {
+        BasicBlock* block = &graph->blocks[i];
+        uint8_t state = blockCovered(map, i) ? LINE_HIT : LINE_MISSED;
+        for(uint32_t address = block->start; address < block->end;
+                address += instructionLength(graph->source, (int)address, (int)graph->length)) {
+            const LineRow* row = lookupLine(info, address);
+            if(row == NULL || row->file >= info->fileCount) continue;
+            if(lines[row->file][row->line] < state) lines[row->file][row->line] = state;
+        }
+    }
+    return lines;
+}
+
+static void freeLines(uint8_t** lines, DebugInfo* info) {
+    for(uint32_t i = 0; i < info->fileCount; i++)
+        free(lines[i]);
+    free(lines);
+}
+
+void writeLcov(FILE* file, ControlFlowGraph* graph, CoverageMap* map, DebugInfo* info) {
+    uint32_t* lineCounts = calloc(info->fileCount + 1, sizeof(uint32_t));
+    if(lineCounts == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    uint8_t** lines = collectLines(graph, map, info, lineCounts);
+
+    for(uint32_t index = 0; index < info->fileCount; index++) {
+        fprintf(file, "TN:\nSF:%s\n", info->files[index]);
+
+        // functions are placed on the line of their first instruction
+        int found = 0;
+        int hit = 0;
+        for(int i = 0; i < graph->functionCount; i++) {
+            const LineRow* row = lookupLine(info, graph->functions[i].entry);
+            if(row == NULL || row->file != index) continue;
+            fprintf(file, "FN:%u,", row->line);
+            printFunctionName(file, graph, graph->functions[i].entry, info);
+            fprintf(file, "\n");
+        }
+        for(int i = 0; i < graph->functionCount; i++) {
+            const LineRow* row = lookupLine(info, graph->functions[i].entry);
+            if(row == NULL || row->file != index) continue;
+            int block = findBlock(graph, graph->functions[i].entry);
+            bool covered = block >= 0 && blockCovered(map, block);
+            fprintf(file, "FNDA:%d,", covered ? 1 : 0);
+            printFunctionName(file, graph, graph->functions[i].entry, info);
+            fprintf(file, "\n");
+            found++;
+            if(covered) hit++;
+        }
+        fprintf(file, "FNF:%d\nFNH:%d\n", found, hit);
+
+        found = 0;
+        hit = 0;
+        for(uint32_t line = 0; line < lineCounts[index]; line++) {
+            if(lines[index][line] == LINE_NONE) continue;
+            fprintf(file, "DA:%u,%d\n", line, lines[index][line] == LINE_HIT ? 1 : 0);
+            found++;
+            if(lines[index][line] == LINE_HIT) hit++;
+        }
+        fprintf(file, "LF:%d\nLH:%d\nend_of_record\n", found, hit);
+    }
+
+    freeLines(lines, info);
+    free(lineCounts);
+}
+
+static void printRatio(FILE* file, uint32_t hit, uint32_t found) {
+    fprintf(file, "  %6u / %-6u %5.1f%%", hit, found, found > 0 ? 100.0 * hit / found : 100.0);
+}
+
+void writeCoverageSummary(FILE* file, ControlFlowGraph* graph, CoverageMap* map, DebugInfo* info) {
+    uint32_t blocksHit = 0;
+    for(int i = 0; i < graph->blockCount; i++)
+        if(blockCovered(map, i)) blocksHit++;
+    fprintf(file, "blocks");
+    printRatio(file, blocksHit, (uint32_t)graph->blockCount);
+    fprintf(file, "\n");
+    if(info == NULL) return;
+
+    uint32_t* lineCounts = calloc(info->fileCount + 1, sizeof(uint32_t));
+    if(lineCounts == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    uint8_t** lines = collectLines(graph, map, info, lineCounts);
+
+    uint32_t totalFound = 0;
+    uint32_t totalHit = 0;
+    fprintf(file, "\nlines hit per file\n");
+    for(uint32_t index = 0; index < info->fileCount; index++) {
+        uint32_t found = 0;
+        uint32_t hit = 0;
+        for(uint32_t line = 0; line < lineCounts[index]; line++) {
+            if(lines[index][line] != LINE_NONE) found++;
+            if(lines[index][line] == LINE_HIT) hit++;
+        }
+        printRatio(file, hit, found);
+        fprintf(file, "  %s\n", info->files[index]);
+        totalFound += found;
+        totalHit += hit;
+    }
+    printRatio(file, totalHit, totalFound);
+    fprintf(file, "  total\n");
+
+    freeLines(lines, info);
+    free(lineCounts);
+}
@@ -0,0 +1,385 @@
+#include <stdio.h>
+
+#include "debug.h"
+#include "debugger.h"
+#include "opcodes.h"
+#include "vm.h"
+
+// breakpoints are `trap` opcodes patched into a private copy of the image, so
+// code between breakpoints runs through the normal dispatch loop untouched.
+// single-stepping patches temporary traps at every address the current
+// instruction can continue at, watchpoints single-step and compare.
+
+#define COMMAND_MAX 256
+
+typedef struct {
+    uint8_t* original;          // the image as loaded, never patched
+    uint8_t* code;              // the copy the vm runs, with traps patched in
+    size_t length;
+    bool* breakpoints;
+    bool* starts;               // instruction boundaries found by a linear sweep
+    DebugInfo* info;
+    bool running;
+    bool watching;
+    uint8_t watchRegister;
+    uint16_t watchValue;
+} Debugger;
+
+static uint32_t instructionEnd(Debugger* debugger, uint32_t address) {
+    return address + instructionLength(debugger->original, (int)address, (int)debugger->length);
+}
+
+// every address execution can reach next from the instruction at ip
+static int successors(Debugger* debugger, uint16_t ip, uint32_t* next) {
+    const uint8_t* source = debugger->original;
+    uint32_t end = instructionEnd(debugger, ip);
+    switch(source[ip]) {
+        case OP_HALT:
+        case OP_TRAP:
+            return 0;
+        case OP_JMP:
+        case OP_CALL:
+        case OP_CALLW:
+            next[0] = (uint16_t)((source[ip + 1] << 8) | source[ip + 2]);
+            return 1;
+        case OP_JNZ:
+        case OP_JZ:
+            next[0] = end;
+            next[1] = (uint16_t)((source[ip + 2] << 8) | source[ip + 3]);
+            return 2;
+        case OP_JMPS:
+        case OP_CALLS:
+            next[0] = (uint16_t)(end + (int8_t)source[ip + 1]);
+            return 1;
+        case OP_JNZS:
+        case OP_JZS:
+            next[0] = end;
+            next[1] = (uint16_t)(end + (int8_t)source[ip + 2]);
+            return 2;
+        case OP_RET:
+            if(vm.stackTop == vm.stack) return 0;
+            next[0] = vm.stackTop[-1];
+            return 1;
+        case OP_RETW:
+            if(vm.windowCount == 0) return 0;
+            next[0] = vm.returns[vm.windowCount - 1];
+            return 1;
+        case OP_SPAWN:
+            // the new thread starts at the target
+            next[0] = end;
+            next[1] = (uint16_t)((source[ip + 2] << 8) | source[ip + 3]);
+            return 2;
+        default: {
+            next[0] = end;
+            if(instructionInfo[source[ip]].flow != FLOW_BRANCH) return 1;
+            // compare and branch
+            int at = ip + addressOffset(instructionInfo[source[ip]].layout);
+            next[1] = (uint16_t)((source[at] << 8) | source[at + 1]);
+            return 2;
+        }
+    }
+}
+
+static void printLocation(Debugger* debugger, const char* reason) {
+    printf("%s at ", reason);
+    disassembleInstruction(debugger->original, vm.ip);
+    printf("\n");
+}
+
+// run exactly one instruction. the byte under ip is put back for the step so a
+// breakpoint there doesn't fire again, then re-armed.
+static VMStatus stepInstruction(Debugger* debugger) {
+    uint16_t ip = vm.ip;
+    if(debugger->original[ip] == OP_TRAP) {
+        vm.ip++; // a trap assembled into the image, step over it
+        return VM_TRAP;
+    }
+
+    uint32_t next[2];
+    int count = successors(debugger, ip, next);
+    for(int i = 0; i < count; i++) {
+        if(next[i] == ip) {
+            printf("instruction at 0x%04x branches to itself.\n", ip);
+            return VM_TRAP;
+        }
+    }
+
+    bool patched[2] = { false, false };
+    for(int i = 0; i < count; i++) {
+        if(next[i] < debugger->length && debugger->code[next[i]] != OP_TRAP) {
+            debugger->code[next[i]] = OP_TRAP;
+            patched[i] = true;
+        }
+    }
+
+    uint8_t saved = debugger->code[ip];
+    debugger->code[ip] = debugger->original[ip];
+    VMStatus status = resume();
+    debugger->code[ip] = saved;
+
+    for(int i = 0; i < count; i++)
+        if(patched[i]) debugger->code[next[i]] = debugger->original[next[i]];
+    return status;
+}
+
+static bool atBreakpoint(Debugger* debugger) {
+    return debugger->breakpoints[vm.ip] || debugger->original[vm.ip] == OP_TRAP;
+}
+
+static bool watchTriggered(Debugger* debugger) {
+    if(!debugger->watching) return false;
+    uint16_t value = vm.regs[debugger->watchRegister];
+    if(value == debugger->watchValue) return false;
+    printf("%s changed from %d to %d\n", registerNames[debugger->watchRegister], debugger->watchValue, value);
+    debugger->watchValue = value;
+    return true;
+}
+
+static VMStatus continueExecution(Debugger* debugger) {
+    // watching a register means looking after every instruction
+    if(debugger->watching) {
+        for(;;) {
+            uint16_t ip = vm.ip;
+            VMStatus status = stepInstruction(debugger);
+            if(status == VM_HALT || vm.ip == ip) return status;
+            if(watchTriggered(debugger) || atBreakpoint(debugger)) return VM_TRAP;
+        }
+    }
+
+    if(atBreakpoint(debugger)) {
+        uint16_t ip = vm.ip;
+        VMStatus status = stepInstruction(debugger);
+        if(status == VM_HALT || vm.ip == ip || atBreakpoint(debugger)) return status;
+    }
+    return resume();
+}
+
+static void report(Debugger* debugger, VMStatus status) {
+    if(status == VM_HALT) {
+        printf("program halted.\n");
+        debugger->running = false;
+        return;
+    }
+
+    if(debugger->breakpoints[vm.ip]) printLocation(debugger, "breakpoint");
+    else if(debugger->original[vm.ip] == OP_TRAP) printLocation(debugger, "trap");
+    else printLocation(debugger, "stopped");
+}
+
+static bool parseRegister(const char* text, uint8_t* reg) {
+    for(uint8_t i = 0; i < NUM_REGS; i++) {
+        if(strcmp(registerNames[i], text) == 0) {
+            *reg = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool findLine(Debugger* debugger, const char* text, uint32_t* address) {
+    const char* colon = strrchr(text, ':');
+    char* end;
+    long line = strtol(colon + 1, &end, 10);
+    if(*end != '\0' || line <= 0) return false;
+
+    size_t nameLength = (size_t)(colon - text);
+    DebugInfo* info = debugger->info;
+
+    // the first instruction on the line, or the closest one after it
+    bool found = false;
+    uint32_t bestLine = 0;
+    uint32_t bestAddress = 0;
+    for(uint32_t i = 0; i < info->rowCount; i++) {
+        LineRow* row = &info->rows[i];
+        const char* file = info->files[row->file];
+        size_t fileLength = strlen(file);
+        bool sameFile = fileLength >= nameLength && memcmp(file + fileLength - nameLength, text, nameLength) == 0 &&
+            (fileLength == nameLength || file[fileLength - nameLength - 1] == '/');
+        if(!sameFile || row->line < (uint32_t)line) continue;
+        if(!found || row->line < bestLine || (row->line == bestLine && row->address < bestAddress)) {
+            found = true;
+            bestLine = row->line;
+            bestAddress = row->address;
+        }
+    }
+    if(found) *address = bestAddress;
+    return found;
+}
+
+// a location is an address, a label or file:line
+static bool parseLocation(Debugger* debugger, const char* text, uint32_t* address) {
+    bool found = false;
+    if(text[0] >= '0' && text[0] <= '9') {
+        char* end;
+        *address = (uint32_t)strtoul(text, &end, 0);
+        found = *end == '\0';
+    } else if(debugger->info != NULL && strchr(text, ':') != NULL) {
+        found = findLine(debugger, text, address);
+    } else if(debugger->info != NULL) {
+        for(uint32_t i = 0; i < debugger->info->labelCount && !found; i++) {
+            if(strcmp(debugger->info->labels[i].name, text) == 0) {
+                *address = debugger->info->labels[i].address;
+                found = true;
+            }
+        }
+    }
+
+    if(!found) {
+        printf("unknown location `%s`.\n", text);
+        return false;
+    }
+    if(*address >= debugger->length || *address > 0xFFFF || !debugger->starts[*address]) {
+        printf("0x%04x is not the start of an instruction.\n", *address);
+        return false;
+    }
+    return true;
+}
+
+static void setBreakpoint(Debugger* debugger, const char* text, bool enable) {
+    uint32_t address;
+    if(!parseLocation(debugger, text, &address)) return;
+
+    debugger->breakpoints[address] = enable;
+    debugger->code[address] = enable ? OP_TRAP : debugger->original[address];
+    printf("breakpoint %s 0x%04x\n", enable ? "set at" : "removed from", address);
+}
+
+static void printRegisters() {
+    for(int i = 0; i < NUM_REGS; i++)
+        printf("%-4s0x%04x  %5d%s", registerNames[i], vm.regs[i], vm.regs[i],
+            i % 4 == 3 || i == NUM_REGS - 1 ? "\n" : "    ");
+    printf("ip  0x%04x\n", vm.ip);
+    if(vm.windowCount > 0)
+        printf("%d register window%s open, retw goes to 0x%04x\n", vm.windowCount,
+            vm.windowCount == 1 ? "" : "s", vm.returns[vm.windowCount - 1]);
+}
+
+static void printStack() {
+    if(vm.stackTop == vm.stack) {
+        printf("stack is empty.\n");
+        return;
+    }
+    for(uint16_t* slot = vm.stackTop - 1; slot >= vm.stack; slot--)
+        printf("%3d  0x%04x  %5d\n", (int)(slot - vm.stack), *slot, *slot);
+}
+
+static void listInstructions(Debugger* debugger, int count) {
+    uint32_t address = vm.ip;
+    for(int i = 0; i < count && address < debugger->length; i++) {
+        printf("%s", address == vm.ip ? "=> " : "   ");
+        address = disassembleInstruction(debugger->original, (int)address);
+        printf("\n");
+    }
+}
+
+static void printHelp() {
+    printf("break <location>     set a breakpoint at an address, label or file:line\n");
+    printf("delete <location>    remove a breakpoint\n");
+    printf("continue             run until a breakpoint, trap, watchpoint or halt\n");
+    printf("step [count]         run count instructions, 1 by default\n");
+    printf("watch <register>     stop when the register changes\n");
+    printf("unwatch              remove the watchpoint\n");
+    printf("regs                 show registers\n");
+    printf("stack                show the stack, top first\n");
+    printf("list [count]         disassemble from the current instruction\n");
+    printf("quit                 leave the debugger\n");
+}
+
+static bool isCommand(const char* command, const char* name, const char* shorthand) {
+    return strcmp(command, name) == 0 || (shorthand != NULL && strcmp(command, shorthand) == 0);
+}
+
+static bool requireRunning(Debugger* debugger) {
+    if(!debugger->running) printf("the program is not running.\n");
+    return debugger->running;
+}
+
+static void markInstructions(Debugger* debugger) {
+    for(uint32_t address = 0; address < debugger->length; address = instructionEnd(debugger, address))
+        debugger->starts[address] = true;
+}
+
+int debugImage(uint8_t* image, size_t length, DebugInfo* info) {
+    Debugger debugger;
+    debugger.original = image;
+    debugger.length = length;
+    debugger.code = malloc(length + 1);
+    debugger.breakpoints = calloc(length + 1, sizeof(bool));
+    debugger.starts = calloc(length + 1, sizeof(bool));
+    if(debugger.code == NULL || debugger.breakpoints == NULL || debugger.starts == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        return 1;
+    }
+    memcpy(debugger.code, image, length + 1);
+    debugger.info = info;
+    debugger.running = true;
+    debugger.watching = false;
+    markInstructions(&debugger);
+
+    vm.source = debugger.code;
+    vm.ip = 0;
+    setThreadSource(debugger.original);
+    printLocation(&debugger, "stopped");
+
+    char line[COMMAND_MAX];
+    for(;;) {
+        printf("(sdb) ");
+        fflush(stdout);
+        if(fgets(line, sizeof(line), stdin) == NULL) break;
+
+        char* command = strtok(line, " \t\r\n");
+        char* argument = strtok(NULL, " \t\r\n");
+        if(command == NULL) continue;
+
+        if(isCommand(command, "break", "b")) {
+            if(argument == NULL) printf("break needs a location.\n");
+            else setBreakpoint(&debugger, argument, true);
+        } else if(isCommand(command, "delete", "d")) {
+            if(argument == NULL) printf("delete needs a location.\n");
+            else setBreakpoint(&debugger, argument, false);
+        } else if(isCommand(command, "continue", "c")) {
+            if(requireRunning(&debugger)) report(&debugger, continueExecution(&debugger));
+        } else if(isCommand(command, "step", "s")) {
+            if(requireRunning(&debugger)) {
+                int count = argument != NULL ? atoi(argument) : 1;
+                VMStatus status = VM_TRAP;
+                for(int i = 0; i < count; i++) {
+                    uint16_t ip = vm.ip;
+                    status = stepInstruction(&debugger);
+                    if(status == VM_HALT || vm.ip == ip) break;
+                    if(watchTriggered(&debugger) || atBreakpoint(&debugger)) break;
+                }
+                report(&debugger, status);
+            }
+        } else if(isCommand(command, "watch", "w")) {
+            uint8_t reg;
+            if(argument == NULL || !parseRegister(argument, &reg)) {
+                printf("watch needs a register.\n");
+            } else {
+                debugger.watching = true;
+                debugger.watchRegister = reg;
+                debugger.watchValue = vm.regs[reg];
+                printf("watching %s\n", registerNames[reg]);
+            }
+        } else if(isCommand(command, "unwatch", NULL)) {
+            debugger.watching = false;
+        } else if(isCommand(command, "regs", "r")) {
+            printRegisters();
+        } else if(isCommand(command, "stack", NULL)) {
+            printStack();
+        } else if(isCommand(command, "list", "l")) {
+            listInstructions(&debugger, argument != NULL ? atoi(argument) : 5);
+        } else if(isCommand(command, "quit", "q")) {
+            break;
+        } else if(isCommand(command, "help", "h")) {
+            printHelp();
+        } else {
+            printf("unknown command `%s`, try help.\n", command);
+        }
+    }
+
+    free(debugger.code);
+    free(debugger.breakpoints);
+    free(debugger.starts);
+    return 0;
+}
@@ -0,0 +1,237 @@
+#include <stdio.h>
+
+#include "debuginfo.h"
+
+typedef struct {
+    const uint8_t* current;
+    const uint8_t* end;
+    bool error;
+} Reader;
+
+static bool canRead(Reader* reader, size_t size) {
+    if(reader->error || (size_t)(reader->end - reader->current) < size) {
+        reader->error = true;
+        return false;
+    }
+    return true;
+}
+
+static uint8_t readByte(Reader* reader) {
+    if(!canRead(reader, 1)) return 0;
+    return *reader->current++;
+}
+
+static uint16_t read16(Reader* reader) {
+    if(!canRead(reader, 2)) return 0;
+    uint16_t value = (uint16_t)((reader->current[0] << 8) | reader->current[1]);
+    reader->current += 2;
+    return value;
+}
+
+static uint32_t read32(Reader* reader) {
+    if(!canRead(reader, 4)) return 0;
+    const uint8_t* p = reader->current;
+    reader->current += 4;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t readUleb(Reader* reader) {
+    uint32_t value = 0;
+    for(int shift = 0; shift < 35; shift += 7) {
+        uint8_t byte = readByte(reader);
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return value;
+    }
+    reader->error = true;
+    return 0;
+}
+
+static int32_t readSleb(Reader* reader) {
+    int32_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = readByte(reader);
+        value |= (int32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while((byte & 0x80) && shift < 35);
+    if(shift < 32 && (byte & 0x40)) value |= -(1 << shift);
+    return value;
+}
+
+static const char* readName(Reader* reader) {
+    uint16_t length = read16(reader);
+    if(!canRead(reader, length)) return NULL;
+    char* name = malloc(length + 1);
+    if(name == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    memcpy(name, reader->current, length);
+    name[length] = '\0';
+    reader->current += length;
+    return name;
+}
+
+static void addRow(DebugInfo* info, uint32_t* capacity, uint32_t address, uint32_t file, uint32_t line) {
+    if(*capacity < info->rowCount + 1) {
+        *capacity = *capacity < 8 ? 8 : *capacity * 2;
+        info->rows = realloc(info->rows, sizeof(LineRow) * *capacity);
+        if(info->rows == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+    }
+    info->rows[info->rowCount].address = address;
+    info->rows[info->rowCount].file = file;
+    info->rows[info->rowCount].line = line;
+    info->rowCount++;
+}
+
+// the line program is expanded into rows once, lookups are then a binary search
+static bool runLineProgram(Reader* reader, DebugInfo* info) {
+    uint32_t capacity = 0;
+    uint32_t address = 0;
+    uint32_t file = 0;
+    uint32_t line = 1;
+
+    for(;;) {
+        uint8_t opcode = readByte(reader);
+        if(reader->error) return false;
+
+        if(opcode >= DBG_OPCODE_BASE) {
+            int adjusted = opcode - DBG_OPCODE_BASE;
+            address += adjusted / DBG_LINE_RANGE;
+            line += DBG_LINE_BASE + adjusted % DBG_LINE_RANGE;
+            addRow(info, &capacity, address, file, line);
+            continue;
+        }
+
+        switch(opcode) {
+            case DBG_END:
+                return true;
+            case DBG_SET_FILE:
+                file = readUleb(reader);
+                if(file >= info->fileCount) return false;
+                break;
+            case DBG_ADVANCE_LINE:
+                line += readSleb(reader);
+                break;
+            case DBG_ADVANCE_ADDRESS:
+                address += readUleb(reader);
+                break;
+            case DBG_ROW:
+                addRow(info, &capacity, address, file, line);
+                break;
+            default:
+                return false;
+        }
+    }
+}
+
+static bool parseDebugInfo(Reader* reader, DebugInfo* info) {
+    if(!canRead(reader, DEBUG_HEADER_SIZE) || memcmp(reader->current, DEBUG_MAGIC, 4) != 0) return false;
+    reader->current += 4;
+    if(read16(reader) != DEBUG_VERSION) return false;
+
+    uint32_t fileCount = read32(reader);
+    uint32_t labelCount = read32(reader);
+    read32(reader); // program size, the program is terminated by DBG_END
+
+    // every entry takes at least two bytes, larger counts can only be corrupt
+    size_t remaining = reader->end - reader->current;
+    if(fileCount > remaining / 2 || labelCount > remaining / 2) return false;
+
+    info->files = calloc(fileCount, sizeof(const char*));
+    info->labels = calloc(labelCount, sizeof(DebugLabel));
+    if((fileCount > 0 && info->files == NULL) || (labelCount > 0 && info->labels == NULL)) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    for(uint32_t i = 0; i < fileCount; i++) {
+        info->files[i] = readName(reader);
+        if(info->files[i] == NULL) return false;
+        info->fileCount++;
+    }
+    for(uint32_t i = 0; i < labelCount; i++) {
+        info->labels[i].address = read32(reader);
+        info->labels[i].name = readName(reader);
+        if(info->labels[i].name == NULL) return false;
+        info->labelCount++;
+    }
+
+    return runLineProgram(reader, info);
+}
+
+bool loadDebugInfo(const char* path, DebugInfo* info) {
+    memset(info, 0, sizeof(DebugInfo));
+
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) return false;
+
+    fseek(file, 0L, SEEK_END);
+    size_t fileSize = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+
+    uint8_t* data = malloc(fileSize);
+    if(data == NULL || fread(data, 1, fileSize, file) < fileSize) {
+        fprintf(stderr, "error reading debug info `%s`.\n", path);
+        fclose(file);
+        free(data);
+        return false;
+    }
+    fclose(file);
+
+    // names are copied out, nothing points into the file once it is parsed
+    Reader reader;
+    reader.current = data;
+    reader.end = data + fileSize;
+    reader.error = false;
+    bool valid = parseDebugInfo(&reader, info);
+    free(data);
+
+    if(!valid) {
+        fprintf(stderr, "`%s` is not valid debug info.\n", path);
+        freeDebugInfo(info);
+    }
+    return valid;
+}
+
+void freeDebugInfo(DebugInfo* info) {
+    for(uint32_t i = 0; i < info->fileCount; i++)
+        free((char*)info->files[i]);
+    for(uint32_t i = 0; i < info->labelCount; i++)
+        free((char*)info->labels[i].name);
+    free(info->files);
+    free(info->labels);
+    free(info->rows);
+    memset(info, 0, sizeof(DebugInfo));
+}
+
+const LineRow* lookupLine(DebugInfo* info, uint32_t address) {
+    if(info->rowCount == 0 || address < info->rows[0].address) return NULL;
+
+    // last row at or before the address
+    uint32_t low = 0;
+    uint32_t high = info->rowCount;
+    while(high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if(info->rows[middle].address <= address) low = middle;
+        else high = middle;
+    }
+    return &info->rows[low];
+}
+
+const DebugLabel* lookupLabel(DebugInfo* info, uint32_t address) {
+    if(info->labelCount == 0 || address < info->labels[0].address) return NULL;
+
+    uint32_t low = 0;
+    uint32_t high = info->labelCount;
+    while(high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if(info->labels[middle].address <= address) low = middle;
+        else high = middle;
+    }
+    return &info->labels[low];
+}
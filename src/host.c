@@ -0,0 +1,68 @@
+#include <stdio.h>
+
+#include "host.h"
+#include "vm.h"
+
+static uint16_t stackDepth(VM* vm) {
+    return (uint16_t)(vm->stackTop - vm->stack);
+}
+
+static void checkStack(VM* vm, uint16_t count, const char* name) {
+    if(count > stackDepth(vm)) {
+        fprintf(stderr, "host function `%s` expected %d stack values, found %d.\n", name, count, stackDepth(vm));
+        exit(1);
+    }
+}
+
+static void hostHash(VM* vm) {
+    uint16_t count = vm->regs[cx];
+    checkStack(vm, count, "hash");
+
+    uint32_t hash = 2166136261u;
+    for(uint16_t i = 0; i < count; i++) {
+        uint16_t value = *--vm->stackTop;
+        hash ^= (uint8_t)value;
+        hash *= 16777619;
+        hash ^= (uint8_t)(value >> 8);
+        hash *= 16777619;
+    }
+
+    vm->regs[ax] = (uint16_t)((hash >> 16) ^ hash);
+}
+
+static int compareDescending(const void* a, const void* b) {
+    uint16_t x = *(const uint16_t*)a;
+    uint16_t y = *(const uint16_t*)b;
+    return (x < y) - (x > y);
+}
+
+static void hostSort(VM* vm) {
+    uint16_t count = vm->regs[cx];
+    checkStack(vm, count, "sort");
+
+    // the top of the stack is the end of the array, so sorting descending
+    // leaves the smallest value to be popped first
+    qsort(vm->stackTop - count, count, sizeof(uint16_t), compareDescending);
+}
+
+static void hostSum(VM* vm) {
+    uint16_t count = vm->regs[cx];
+    checkStack(vm, count, "sum");
+
+    uint16_t sum = 0;
+    for(uint16_t i = 0; i < count; i++)
+        sum += *--vm->stackTop;
+
+    vm->regs[ax] = sum;
+}
+
+static void hostNewline(VM* vm) {
+    fputc('\n', vm->out);
+}
+
+void registerBuiltinHostFunctions() {
+    registerHostFunction(HOST_HASH, hostHash);
+    registerHostFunction(HOST_SORT, hostSort);
+    registerHostFunction(HOST_SUM, hostSum);
+    registerHostFunction(HOST_NEWLINE, hostNewline);
+}
@@ -3,17 +3,68 @@
 #include <stdio.h>
 
 #include "common.h"
+#include "object.h"
 #include "opcodes.h"
+#include "table.h"
 
 typedef struct {
-    uint8_t bytesWritten;
+    Symbol* label;              // or the string a `printp` prints
+    int offset;
+    bool string;
+} Fixup;
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t reg1;
+    uint8_t reg2;
+    uint16_t value;             // immediate, numeric address or host function index
+    uint16_t immediate;         // compared against by the jlti family, which also has an address
+    Symbol* label;              // address operand given as a label
+    Symbol* string;             // printcs operand, kept when it becomes printp
+    bool shortForm;             // encoded as a relative branch, set by relaxation
+    uint32_t file;              // index into the unit's file list
+    uint32_t line;
+} Instruction;
+
+typedef unsigned __int128 CacheHash;
+
+typedef struct {
+    int instructionCount;
+    int instructionCapacity;
+    Instruction* instructions;
     int count;
     int capacity;
     uint8_t* buffer;
+    int fixupCount;
+    int fixupCapacity;
+    Fixup* fixups;
+    Table labels;
+    Table strings;
+    int fileCount;
+    int fileCapacity;
+    const char** files;         // every file read for the unit, includes too
+    bool hashFiles;             // set when the unit will be cached
+    CacheHash* fileHashes;      // content of each file as it was read
+    int lineCount;
+    int lineCapacity;
+    SourceLine* lines;          // filled by encoding when debug info is wanted
 } Assembler;
 
-#define GROW_BUFFER(assembler) assembler.buffer = realloc(assembler.buffer, ++assembler.capacity)
+#define GROW_BUFFER(assembler) assembler->buffer = realloc(assembler->buffer, assembler->capacity)
+
+#define GROW_CAPACITY(capacity) \
+    ((capacity) < 8 ? 8 : (capacity) * 2)
 
-#define GROW_CAPACITY(capacity) (++capacity)
+typedef struct {
+    bool object;                // emit a relocatable object instead of an image
+    bool optimize;              // run the peephole optimizer before encoding
+    bool debug;                 // write line tables and labels to <out>.sdbg
+    int jobs;                   // number of units assembled concurrently
+    const char* cache;          // directory of cached units, NULL for none
+} AssemblerOptions;
 
-void assemble(FILE* file, char* outf);
\ No newline at end of file
+void assembleFile(Assembler* assembler, const char* path);
+void assembleObject(const char* path, Object* object, AssemblerOptions* options, CacheHash* entry);
+bool isRelocatable(Assembler* assembler);
+void optimizeInstructions(Assembler* assembler, const char* path);
+void assemble(const char** inputs, int count, const char* outf, AssemblerOptions* options);
\ No newline at end of file
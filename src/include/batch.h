@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "vm.h"
+
+#define BATCH_RECORD_MAX (STACK_MAX - 32)  // leaves the image room on the stack
+#define BATCH_BLOCK 65536                  // records read before they are run
+#define BATCH_CHUNK 256                    // records a worker takes at a time
+
+typedef enum {
+    RECORDS_LINES,              // one record per line, the newline is dropped
+    RECORDS_LENGTH,             // a big endian 16-bit length, then the bytes
+} RecordFormat;
+
+// runs the image once per record of input for `synthetic -b`. every run
+// starts with clear registers and stack, the record's bytes on the stack
+// with its first byte on top, and its length in cx. records are spread over
+// jobs threads and their output is written in input order.
+int runBatch(uint8_t* image, FILE* input, RecordFormat format, int jobs);
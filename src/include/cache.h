@@ -0,0 +1,40 @@
+#pragma once
+
+#include "assembler.h"
+#include "common.h"
+#include "object.h"
+
+// content-addressed cache of assembled units for `synas -C dir`
+//
+// a unit's key is a 128-bit FNV-1a hash of the assembler version, the
+// instruction set, the options that change the object, the unit's path and
+// the hash of its source. the key names a manifest listing the files the
+// unit included last time; hashing their paths and current contents onto
+// the key gives the unit's entry, which holds the object, line table and
+// file list. an image is keyed by the entries of its units in link order.
+//
+//  <key>.manifest      include paths, one per line
+//  <entry>.unit        object file bytes, u32 file count, u16 length and
+//                      bytes per path, u32 line count, u32 offset, file and
+//                      line per row
+//  <image>.image       the linked image
+//  <image>.sdbg        its debug info, for `-g`
+//
+// every file is written under a temporary name and renamed into place, so
+// builds sharing a cache only ever see whole files.
+
+CacheHash hashContent(const void* data, size_t length);
+
+// fills object and the unit's entry from the cache, false on a miss
+bool loadCachedUnit(const char* cache, const char* path, AssemblerOptions* options,
+    Object* object, CacheHash* entry);
+
+// hashes holds the content hash of each of the object's files as it was
+// read while assembling, returns the unit's entry
+CacheHash storeCachedUnit(const char* cache, const char* path, AssemblerOptions* options,
+    Object* object, CacheHash* hashes);
+
+// writes outf, and outf.sdbg for `-g`, straight from the cache when every
+// unit and the image linked from them are there
+bool loadCachedImage(const char* cache, const char** inputs, int count, AssemblerOptions* options, const char* outf);
+void storeCachedImage(const char* cache, CacheHash* entries, int count, AssemblerOptions* options, const char* outf);
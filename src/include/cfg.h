@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "common.h"
+#include "debuginfo.h"
+
+// control flow graph of an image, built from the flow column of the opcode
+// table. calls don't end a basic block, every call and spawn target starts a
+// function.
+
+typedef struct {
+    uint32_t start;             // address of the first instruction
+    uint32_t end;               // address after the last instruction
+    uint32_t instructions;
+    int successors[2];          // block indices, -1 when absent
+} BasicBlock;
+
+typedef struct {
+    int header;                 // block index
+    int* blocks;                // every block in the loop, header included
+    int blockCount;
+} Loop;
+
+typedef struct {
+    uint32_t entry;
+    int* blocks;                // reachable blocks in reverse postorder, entry first
+    int blockCount;
+    int* dominators;            // immediate dominator of each block, by position in blocks
+    Loop* loops;
+    int loopCount;
+
+    // filled by analyzeFunctions
+    int maxStack;               // deepest the stack gets during a call, callees included
+    uint32_t cost;              // instructions on the longest path through a call, loops taken once
+    bool stackUnbounded;        // a loop keeps pushing
+    bool recursive;
+    bool usesHost;              // `sys` changes the stack by an amount only known at run time
+    int state;
+} Function;
+
+typedef struct {
+    const uint8_t* source;
+    uint32_t length;            // code only, the string pool is left out
+    BasicBlock* blocks;         // sorted by address
+    int blockCount;
+    Function* functions;        // sorted by entry address
+    int functionCount;
+} ControlFlowGraph;
+
+void buildGraph(ControlFlowGraph* graph, const uint8_t* source, uint32_t length);
+void freeGraph(ControlFlowGraph* graph);
+
+// block index of the block starting at or containing an address, -1 if none
+int findBlock(ControlFlowGraph* graph, uint32_t address);
+
+void analyzeFunctions(ControlFlowGraph* graph);
+
+// label from info when there is one, otherwise main or sub_<address>
+void printFunctionName(FILE* file, ControlFlowGraph* graph, uint32_t address, DebugInfo* info);
+void writeDot(ControlFlowGraph* graph, FILE* file, DebugInfo* info);
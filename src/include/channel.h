@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+
+#define CHANNEL_MAX 64          // channels numbered 0 to 63, shared by every VM in the process
+#define CHANNEL_SIZE 1024       // values a channel holds before send waits, power of two
+
+// bounded lock-free rings of 16-bit values. any number of threads may send
+// and receive on the same channel at once: every value is received exactly
+// once, and values from one sender arrive in the order it sent them. senders
+// only contend with senders for the send position and receivers with
+// receivers for the receive position.
+
+void initChannels();
+
+// waits while the channel is full
+void channelSend(uint16_t channel, uint16_t value);
+
+// false when the channel is empty and either wait is false or the channel is
+// closed, otherwise waits for a value
+bool channelReceive(uint16_t channel, uint16_t* value, bool wait);
+
+// nothing more will be sent, receivers drain what is left and then see it
+// closed. a send that starts after the close may be lost.
+void closeChannel(uint16_t channel);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "common.h"
+
+// basic block coverage for `synthetic -c`. every block leader in a copy of
+// the image is patched with a trap, the first time a block runs its trap sets
+// the block's bit and puts the instruction back, so a block costs one trap per
+// run and code that has already been covered runs untouched.
+
+// the copy to run in place of image
+uint8_t* startCoverage(const uint8_t* image, size_t length);
+
+// merges the blocks hit into the coverage file at path
+bool finishCoverage(const char* path);
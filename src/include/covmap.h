@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "cfg.h"
+#include "common.h"
+#include "debuginfo.h"
+
+// basic block coverage written by `synthetic -c`, read and merged by syncov
+//
+// all multi-byte fields are big-endian, like operands in an image
+//
+//  header          magic "SCOV", u16 version, u32 image length, u32 image hash, u32 block count
+//  bitmap          one bit per basic block of the image's control flow graph,
+//                  block i is bit i % 8 of byte i / 8
+//
+// the hash is 32-bit FNV-1a over the image bytes, a map only merges with
+// maps of the same image.
+
+#define COVERAGE_MAGIC "SCOV"
+#define COVERAGE_VERSION 1
+#define COVERAGE_HEADER_SIZE 18
+
+typedef struct {
+    uint32_t imageLength;
+    uint32_t imageHash;
+    uint32_t blockCount;
+    uint8_t* bits;
+} CoverageMap;
+
+void initCoverageMap(CoverageMap* map, const uint8_t* image, uint32_t length, uint32_t blockCount);
+void freeCoverageMap(CoverageMap* map);
+
+static inline bool blockCovered(CoverageMap* map, int block) {
+    return (map->bits[block / 8] >> (block % 8)) & 1;
+}
+
+// prints why and returns false when the file isn't a coverage map
+bool readCoverageMap(const char* path, CoverageMap* map);
+bool writeCoverageMap(const char* path, CoverageMap* map);
+
+// ors from into map, false when they were taken from different images
+bool mergeCoverageMap(CoverageMap* map, CoverageMap* from);
+
+// merges map into the file at path under an exclusive lock, so runs sharing
+// one file can finish at the same time
+bool mergeCoverageFile(const char* path, CoverageMap* map);
+
+// lines and functions hit per source file, in lcov tracefile format
+void writeLcov(FILE* file, ControlFlowGraph* graph, CoverageMap* map, DebugInfo* info);
+
+// lines hit and instrumented per source file, then the total
+void writeCoverageSummary(FILE* file, ControlFlowGraph* graph, CoverageMap* map, DebugInfo* info);
@@ -1,7 +1,11 @@
 #pragma once
 
 #include "common.h"
+#include "debuginfo.h"
 
 //#define DEBUG_TRACE_EXEC
 
+// annotate disassembly with labels and source lines, NULL turns it off
+void setDebugInfo(DebugInfo* info);
+void disassembleSource(uint8_t* source, const char* name, int length);
 int disassembleInstruction(uint8_t* source, int offset);
\ No newline at end of file
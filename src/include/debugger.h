@@ -0,0 +1,7 @@
+#pragma once
+
+#include "common.h"
+#include "debuginfo.h"
+
+// interactive debugger for `synthetic -d`, info may be NULL
+int debugImage(uint8_t* image, size_t length, DebugInfo* info);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common.h"
+
+// debug info written next to an image by `synas -g` as `<image>.sdbg`
+//
+// all multi-byte fields are big-endian, like operands in an image
+//
+//  header          magic "SDBG", u16 version, u32 file count, u32 label count, u32 program size
+//  files           u16 path length, path bytes
+//  labels          u32 address, u16 name length, name bytes, sorted by address
+//  line program    opcodes below, ending with DBG_END
+//
+// the line program is run with address 0, file 0 and line 1 as its starting
+// state. every row it emits marks the address where an instruction from that
+// file and line starts, a row covers the addresses up to the next one.
+
+#define DEBUG_MAGIC "SDBG"
+#define DEBUG_VERSION 1
+#define DEBUG_HEADER_SIZE 18
+
+// a special opcode advances address and line together and emits a row, the
+// line delta is opcode - DBG_OPCODE_BASE mod DBG_LINE_RANGE plus DBG_LINE_BASE
+// and the address delta is opcode - DBG_OPCODE_BASE div DBG_LINE_RANGE
+#define DBG_LINE_BASE -3
+#define DBG_LINE_RANGE 12
+#define DBG_OPCODE_BASE 0x10
+
+typedef enum {
+    DBG_END,                    // -
+    DBG_SET_FILE,               // uleb file index
+    DBG_ADVANCE_LINE,           // sleb line delta
+    DBG_ADVANCE_ADDRESS,        // uleb address delta
+    DBG_ROW,                    // emit a row for the current state
+} DebugOpcode;
+
+typedef struct {
+    uint32_t address;
+    uint32_t file;
+    uint32_t line;
+} LineRow;
+
+typedef struct {
+    const char* name;
+    uint32_t address;
+} DebugLabel;
+
+typedef struct {
+    const char** files;
+    uint32_t fileCount;
+    DebugLabel* labels;
+    uint32_t labelCount;
+    LineRow* rows;
+    uint32_t rowCount;
+} DebugInfo;
+
+bool loadDebugInfo(const char* path, DebugInfo* info);
+void freeDebugInfo(DebugInfo* info);
+
+// the row and the label covering an address, NULL if there is none
+const LineRow* lookupLine(DebugInfo* info, uint32_t address);
+const DebugLabel* lookupLabel(DebugInfo* info, uint32_t address);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+
+// host functions callable from images through `sys`
+//
+// calling convention: arguments are passed in ax, bx, cx and on the stack,
+// results are returned in ax. functions that consume stack values pop them.
+//
+//  hash    -   pop cx values and store their FNV-1a hash (folded to 16 bits) in ax
+//  sort    -   sort the top cx stack values so they pop in ascending order
+//  sum     -   pop cx values and store their sum in ax
+//  nl      -   print a newline
+#define HOST_FUNCTIONS(X) \
+    X(HOST_HASH,        "hash") \
+    X(HOST_SORT,        "sort") \
+    X(HOST_SUM,         "sum") \
+    X(HOST_NEWLINE,     "nl")
+
+typedef enum {
+#define HOST_ENUM(id, name) id,
+    HOST_FUNCTIONS(HOST_ENUM)
+#undef HOST_ENUM
+    HOST_BUILTIN_COUNT,
+} HostFunctionIndex;
+
+#define HOST_MAX 256
+
+// `sys` names of the builtins, defined in names.c
+extern const char* hostFunctionNames[HOST_BUILTIN_COUNT];
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "common.h"
+#include "opcodes.h"
+
+// collision-free lookup of a fixed set of names by their FNV hash. a seed is
+// searched for at startup so that every name gets a slot of its own, a lookup
+// is then one multiply, one shift and one string compare.
+typedef struct {
+    uint32_t seed;
+    int shift;
+    int capacity;
+    int16_t* slots;
+    const char** names;
+    int count;
+} PerfectHash;
+
+void buildPerfectHash(PerfectHash* table, const char** names, int count);
+int perfectHashLookup(PerfectHash* table, const char* chars, int length, uint32_t hash);
+
+void initInstructionSet();
+const InstructionInfo* lookupInstruction(const char* chars, int length, uint32_t hash, uint8_t* opcode);
+int lookupRegister(const char* chars, int length, uint32_t hash);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common.h"
+
+typedef enum {
+    TOKEN_WORD,                 // mnemonic, register, label reference or path
+    TOKEN_NUMBER,               // word starting with a digit
+    TOKEN_LABEL,                // word followed by `:` (colon not included)
+    TOKEN_DIRECTIVE,            // word starting with `%` (percent included)
+    TOKEN_STRING,               // double quoted string (quotes not included)
+    TOKEN_NEWLINE,
+    TOKEN_EOF,
+    TOKEN_ERROR,
+} TokenType;
+
+// tokens are slices of the source buffer, never copies
+typedef struct {
+    TokenType type;
+    const char* start;
+    int length;
+    uint32_t hash;
+    int line;
+} Token;
+
+typedef struct {
+    const char* current;
+    const char* end;
+    int line;
+} Lexer;
+
+void initLexer(Lexer* lexer, const char* source, size_t length);
+Token scanToken(Lexer* lexer);
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include "common.h"
+
+// relocatable object written by `synas -c` and read by `synld`
+//
+// all multi-byte fields are big-endian, like operands in an image
+//
+//  header          magic "SOBJ", u16 version, u32 code size, u32 symbol count, u32 relocation count,
+//                  u32 string count, u32 string relocation count
+//  code            code bytes with every label and string reference left as 0x0000
+//  symbols         u8 flags, u32 value, u16 name length, name bytes
+//  relocations     u32 code offset, u32 symbol index
+//  strings         u16 length, characters
+//  string relocs   u32 code offset, u32 string index
+//
+// symbol values are offsets from the start of the object's code. every
+// label is global, an undefined symbol is a reference to another object.
+// strings are `printp` operands, the linker merges every object's strings
+// into one pool after the code and points the references at their entries.
+
+#define OBJECT_MAGIC "SOBJ"
+#define OBJECT_VERSION 2
+#define OBJECT_HEADER_SIZE 26
+
+#define SYMBOL_DEFINED 0x01
+
+// size of the `jmp main` stub the linker places in front of the first object
+#define ENTRY_SIZE 3
+
+typedef struct {
+    const char* name;
+    int length;
+    uint32_t value;
+    uint8_t flags;
+} ObjectSymbol;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t symbol;            // index into the symbols, or the strings for a string relocation
+} Relocation;
+
+typedef struct {
+    const char* chars;
+    int length;
+} PoolString;
+
+// source position of the instruction at a code offset, only kept in memory
+// for `synas -g`, object files don't carry it
+typedef struct {
+    uint32_t offset;
+    uint32_t file;
+    uint32_t line;
+} SourceLine;
+
+typedef struct {
+    const char* path;
+    uint8_t* code;
+    uint32_t codeSize;
+    ObjectSymbol* symbols;
+    uint32_t symbolCount;
+    Relocation* relocations;
+    uint32_t relocationCount;
+    PoolString* strings;        // each distinct string the object prints from the pool
+    uint32_t stringCount;
+    Relocation* stringRelocations;
+    uint32_t stringRelocationCount;
+    const char** files;
+    uint32_t fileCount;
+    SourceLine* lines;
+    uint32_t lineCount;
+    uint8_t* storage;           // block the code, names and strings point into
+} Object;
+
+typedef struct {
+    uint8_t entry[ENTRY_SIZE];
+    Object* objects;
+    int count;
+    uint32_t size;              // entry stub and code
+    uint8_t* pool;              // `pool` instruction and the strings, NULL without strings
+    uint32_t poolSize;
+} Image;
+
+void writeOutput(const char* path, struct iovec* iov, int iovcnt);
+uint8_t* encodeObject(Object* object, size_t* size);
+const char* decodeObject(uint8_t* buffer, size_t size, Object* object, size_t* used);
+void writeObject(const char* path, Object* object);
+bool readObject(const char* path, Object* object);
+// frees the object's storage and everything it allocated, not the Object itself
+void freeObject(Object* object);
+
+void linkObjects(Object* objects, int count, Image* image);
+void writeImage(const char* path, Image* image);
+void writeDebugInfo(const char* path, Image* image);
@@ -1,101 +1,218 @@
 #pragma once
 
+#include "common.h"
+
+// operands encoded after the opcode byte, 16-bit values are big-endian
 typedef enum {
-    OP_HALT         = 0x01,                     // halt     -       halt CPU
-    OP_MOV          = 0x02,                     // mov      -       move value into register
-    OP_PRINTC       = 0x03,                     // printc   -       print register value as character
-    OP_PRINTCS      = 0x04,                     // printcs  -       print character string (terminated by 00)
-    OP_PRINTI       = 0x05,                     // printi   -       print register value as integer
-    OP_PRINTH       = 0x06,                     // printh   -       print register value as hexadecimal (base16)
-    OP_SETR         = 0x07,                     // setr     -       set register value to byte
-    OP_INC          = 0x08,                     // inc      -       increment register value
-    OP_DEC          = 0x09,                     // dec      -       decrement register value
-    OP_ADD          = 0x0A,                     // add      -       add register values together and store in dest
-    OP_SUB          = 0x0B,                     // sub      -       subtract register values together and store in dest
-    OP_MUL          = 0x0C,                     // mul      -       multiply register values together and store in dest
-    OP_DIV          = 0x0D,                     // div      -       divide register values together and store in dest
-    OP_JMP          = 0x0E,                     // jmp      -       jump past code in program
-    OP_JNZ          = 0x0F,                     // jnz      -       jump past code in program if register is a non-zero value
-    OP_JZ           = 0x10,                     // jz       -       jump past code in program if register value is zero
-    OP_SHL          = 0x11,                     // shl      -       shift register value left by register value
-    OP_SHR          = 0x12,                     // shr      -       shift register value right by register value
-    OP_XOR          = 0x13,                     // xor      -       xor register value by register value and store in dest
-    OP_OR           = 0x14,                     // or       -       binary or register value by register value and store in dest
-    OP_AND          = 0x15,                     // and      -       binary and register value by register value and store in dest
-    OP_POP          = 0x16,                     // pop      -       pop value from stack into register
-    OP_PUSH         = 0x17,                     // push     -       push value to stack
-    OP_PUSHR        = 0x18,                     // pushr    -       push register value to stack
-    OP_GETIP        = 0x19,                     // getip    -       get instruction pointer and store in register
-    OP_PEEK         = 0x1A,                     // peek     -       peek at value from stack and place in register
-    OP_MOD          = 0x1B,                     // mod      -       modulate register values together and store in dest
-    OP_LT           = 0x1C,                     // lt       -       conditional less than and store result in dest
-    OP_GT           = 0x1D,                     // gt       -       conditional greater than and store result in dest
-    OP_RET          = 0x1E,                     // ret      -       return from procedure (restore ip from stack)
-    OP_CALL         = 0x1F,                     // call     -       call a procedure (place ip on stack)
-    OP_PRINTIS      = 0x20,                     // printis  -       print integer from stack
-    OP_ADDS         = 0x21,                     // adds     -       add two values from stack and push result to stack
-    OP_SUBS         = 0x22,                     // subs     -       subtract two values from stack and push result to stack
-    OP_MULS         = 0x23,                     // muls     -       multiply two values from stack and push result to stack
-    OP_DIVS         = 0x24,                     // divs     -       divide two values from stack and push result to stack
-    OP_LTS          = 0x25,                     // lts      -       conditional less than and push result to stack
-    OP_GTS          = 0x26,                     // gts      -       conditional greater than and push result to stack
-} Opcode;
+    LAYOUT_NONE,                // -
+    LAYOUT_REG,                 // reg
+    LAYOUT_REG_REG,             // dest reg, src reg
+    LAYOUT_REG_IMM,             // reg, imm16
+    LAYOUT_IMM,                 // imm16
+    LAYOUT_ADDR,                // addr16
+    LAYOUT_REG_ADDR,            // reg, addr16
+    LAYOUT_STRING,              // characters terminated by 00
+    LAYOUT_HOST,                // host function index
+    LAYOUT_REL,                 // rel8, signed and relative to the next instruction
+    LAYOUT_REG_REL,             // reg, rel8
+    LAYOUT_REG_REG_ADDR,        // reg, reg, addr16
+    LAYOUT_REG_IMM_ADDR,        // reg, imm16, addr16
+    LAYOUT_POOL,                // size16, then size bytes of strings, each a length16 and its characters
+} OperandLayout;
 
+// how control leaves an instruction, used by tools that build control flow graphs
 typedef enum {
-    H_HALT              = 0xe8bee4fa,       // halt
-    H_MOV               = 0xd19e5c79,       // mov
-    H_PRINTC            = 0xe46faff1,       // printc
-    H_PRINTCS           = 0x1dd149a6,       // printcs
-    H_PRINTI            = 0xda6fa033,       // printi
-    H_PRINTH            = 0xd96f9ea0,       // printh
-    H_SETR              = 0x6070b6e3,       // setr
-    H_INC               = 0xa8e99c47,       // inc
-    H_DEC               = 0xc25979d3,       // dec
-    H_ADD               = 0x3b391274,       // add
-    H_SUB               = 0xdc4e3915,       // sub
-    H_MUL               = 0xeb84ed81,       // mul
-    H_DIV               = 0xe562ab48,       // div
-    H_JMP               = 0xc3cf89c0,       // jmp
-    H_JNZ               = 0xcfd65869,       // jnz
-    H_JZ                = 0x573f5905,       // jz
-    H_SHL               = 0xe02debb6,       // shl
-    H_SHR               = 0xda2de244,       // shr
-    H_XOR               = 0xcc6bdb7e,       // xor
-    H_OR                = 0x5d342984,       // or
-    H_AND               = 0x0f29c2a6,       // and
-    H_POP               = 0x51335fd0,       // pop
-    H_PUSH              = 0x876fffdd,       // push
-    H_PUSHR             = 0xe44f807d,       // pushr
-    H_GETIP             = 0x5360a25e,       // getip
-    H_PEEK              = 0xaf15011e,       // peek
-    H_MOD               = 0xdf9e7283,       // mod
-    H_LT                = 0x5d31eaed,       // lt
-    H_GT                = 0x4b208576,       // gt
-    H_RET               = 0x30f467ac,       // ret
-    H_CALL              = 0xb3f184a9,       // call
-    H_PRINTIS           = 0x1db944c0,       // printis
-    H_ADDS              = 0x41d76105,       // adds
-    H_SUBS              = 0x35245b92,       // subs
-    H_MULS              = 0xb44293f6,       // muls
-    H_DIVS              = 0x55538de1,       // divs
-    H_LTS               = 0x539456ba,       // lts
-    H_GTS               = 0x493166df,       // gts
-} HashedOpcode;
+    FLOW_NEXT,                  // falls through to the next instruction
+    FLOW_JUMP,                  // always continues at its target
+    FLOW_BRANCH,                // continues at its target or the next instruction
+    FLOW_CALL,                  // runs its target, then the next instruction
+    FLOW_RETURN,                // continues at the address popped from the stack
+    FLOW_STOP,                  // execution ends
+    FLOW_SPAWN,                 // continues at the next instruction, a new thread starts at its target
+} ControlFlow;
+
+// stack effect of instructions whose pops depend on run time values
+#define STACK_VARIES -1
+
+// every instruction is defined once here: name, opcode, mnemonic, operand
+// layout, control flow and the number of stack values popped and pushed. the
+// enum, the assembler's mnemonic lookup, the VM dispatch table, the
+// disassembler and the flow analysis are all generated from this list.
+#define OPCODES(X) \
+    X(HALT,        0x01, "halt",     LAYOUT_NONE,     FLOW_STOP,    0,            0)               /* halt CPU */ \
+    X(MOV,         0x02, "mov",      LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* move value into register */ \
+    X(PRINTC,      0x03, "printc",   LAYOUT_REG,      FLOW_NEXT,    0,            0)               /* print register value as character */ \
+    X(PRINTCS,     0x04, "printcs",  LAYOUT_STRING,   FLOW_NEXT,    0,            0)               /* print character string (terminated by 00) */ \
+    X(PRINTI,      0x05, "printi",   LAYOUT_REG,      FLOW_NEXT,    0,            0)               /* print register value as integer */ \
+    X(PRINTH,      0x06, "printh",   LAYOUT_REG,      FLOW_NEXT,    0,            0)               /* print register value as hexadecimal (base16) */ \
+    X(SETR,        0x07, "setr",     LAYOUT_REG_IMM,  FLOW_NEXT,    0,            0)               /* set register value to byte */ \
+    X(INC,         0x08, "inc",      LAYOUT_REG,      FLOW_NEXT,    0,            0)               /* increment register value */ \
+    X(DEC,         0x09, "dec",      LAYOUT_REG,      FLOW_NEXT,    0,            0)               /* decrement register value */ \
+    X(ADD,         0x0A, "add",      LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* add register values together and store in dest */ \
+    X(SUB,         0x0B, "sub",      LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* subtract register values together and store in dest */ \
+    X(MUL,         0x0C, "mul",      LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* multiply register values together and store in dest */ \
+    X(DIV,         0x0D, "div",      LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* divide register values together and store in dest */ \
+    X(JMP,         0x0E, "jmp",      LAYOUT_ADDR,     FLOW_JUMP,    0,            0)               /* jump past code in program */ \
+    X(JNZ,         0x0F, "jnz",      LAYOUT_REG_ADDR, FLOW_BRANCH,  0,            0)               /* jump past code in program if register is a non-zero value */ \
+    X(JZ,          0x10, "jz",       LAYOUT_REG_ADDR, FLOW_BRANCH,  0,            0)               /* jump past code in program if register value is zero */ \
+    X(SHL,         0x11, "shl",      LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* shift register value left by register value */ \
+    X(SHR,         0x12, "shr",      LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* shift register value right by register value */ \
+    X(XOR,         0x13, "xor",      LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* xor register value by register value and store in dest */ \
+    X(OR,          0x14, "or",       LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* binary or register value by register value and store in dest */ \
+    X(AND,         0x15, "and",      LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* binary and register value by register value and store in dest */ \
+    X(POP,         0x16, "pop",      LAYOUT_REG,      FLOW_NEXT,    1,            0)               /* pop value from stack into register */ \
+    X(PUSH,        0x17, "push",     LAYOUT_IMM,      FLOW_NEXT,    0,            1)               /* push value to stack */ \
+    X(PUSHR,       0x18, "pushr",    LAYOUT_REG,      FLOW_NEXT,    0,            1)               /* push register value to stack */ \
+    X(GETIP,       0x19, "getip",    LAYOUT_REG,      FLOW_NEXT,    0,            0)               /* get instruction pointer and store in register */ \
+    X(PEEK,        0x1A, "peek",     LAYOUT_REG,      FLOW_NEXT,    1,            0)               /* peek at value from stack and place in register */ \
+    X(MOD,         0x1B, "mod",      LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* modulate register values together and store in dest */ \
+    X(LT,          0x1C, "lt",       LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* conditional less than and store result in dest */ \
+    X(GT,          0x1D, "gt",       LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* conditional greater than and store result in dest */ \
+    X(RET,         0x1E, "ret",      LAYOUT_NONE,     FLOW_RETURN,  1,            0)               /* return from procedure (restore ip from stack) */ \
+    X(CALL,        0x1F, "call",     LAYOUT_ADDR,     FLOW_CALL,    0,            1)               /* call a procedure (place ip on stack) */ \
+    X(PRINTIS,     0x20, "printis",  LAYOUT_NONE,     FLOW_NEXT,    1,            0)               /* print integer from stack */ \
+    X(ADDS,        0x21, "adds",     LAYOUT_NONE,     FLOW_NEXT,    2,            1)               /* add two values from stack and push result to stack */ \
+    X(SUBS,        0x22, "subs",     LAYOUT_NONE,     FLOW_NEXT,    2,            1)               /* subtract two values from stack and push result to stack */ \
+    X(MULS,        0x23, "muls",     LAYOUT_NONE,     FLOW_NEXT,    2,            1)               /* multiply two values from stack and push result to stack */ \
+    X(DIVS,        0x24, "divs",     LAYOUT_NONE,     FLOW_NEXT,    2,            1)               /* divide two values from stack and push result to stack */ \
+    X(LTS,         0x25, "lts",      LAYOUT_NONE,     FLOW_NEXT,    2,            1)               /* conditional less than and push result to stack */ \
+    X(GTS,         0x26, "gts",      LAYOUT_NONE,     FLOW_NEXT,    2,            1)               /* conditional greater than and push result to stack */ \
+    X(SYS,         0x27, "sys",      LAYOUT_HOST,     FLOW_NEXT,    STACK_VARIES, STACK_VARIES)    /* call registered host function by index */ \
+    X(JMPS,        0x28, "jmps",     LAYOUT_REL,      FLOW_JUMP,    0,            0)               /* jump by a signed 8-bit displacement */ \
+    X(JNZS,        0x29, "jnzs",     LAYOUT_REG_REL,  FLOW_BRANCH,  0,            0)               /* jump by a signed 8-bit displacement if register is a non-zero value */ \
+    X(JZS,         0x2A, "jzs",      LAYOUT_REG_REL,  FLOW_BRANCH,  0,            0)               /* jump by a signed 8-bit displacement if register value is zero */ \
+    X(CALLS,       0x2B, "calls",    LAYOUT_REL,      FLOW_CALL,    0,            1)               /* call a procedure at a signed 8-bit displacement */ \
+    X(LDS,         0x2C, "lds",      LAYOUT_REG_IMM,  FLOW_NEXT,    0,            0)               /* load register from stack slot, counted from the bottom of the stack */ \
+    X(STS,         0x2D, "sts",      LAYOUT_REG_IMM,  FLOW_NEXT,    0,            0)               /* store register value into stack slot */ \
+    X(SHLS,        0x2E, "shls",     LAYOUT_NONE,     FLOW_NEXT,    2,            1)               /* shift value left by value from stack and push result to stack */ \
+    X(SHRS,        0x2F, "shrs",     LAYOUT_NONE,     FLOW_NEXT,    2,            1)               /* shift value right by value from stack and push result to stack */ \
+    X(JLT,         0x30, "jlt",      LAYOUT_REG_REG_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register value is below register value */ \
+    X(JGT,         0x31, "jgt",      LAYOUT_REG_REG_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register value is above register value */ \
+    X(JEQ,         0x32, "jeq",      LAYOUT_REG_REG_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register values are equal */ \
+    X(JNE,         0x33, "jne",      LAYOUT_REG_REG_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register values differ */ \
+    X(JLE,         0x34, "jle",      LAYOUT_REG_REG_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register value is at most register value */ \
+    X(JGE,         0x35, "jge",      LAYOUT_REG_REG_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register value is at least register value */ \
+    X(JLTI,        0x36, "jlti",     LAYOUT_REG_IMM_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register value is below immediate */ \
+    X(JGTI,        0x37, "jgti",     LAYOUT_REG_IMM_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register value is above immediate */ \
+    X(JEQI,        0x38, "jeqi",     LAYOUT_REG_IMM_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register value equals immediate */ \
+    X(JNEI,        0x39, "jnei",     LAYOUT_REG_IMM_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register value differs from immediate */ \
+    X(JLEI,        0x3A, "jlei",     LAYOUT_REG_IMM_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register value is at most immediate */ \
+    X(JGEI,        0x3B, "jgei",     LAYOUT_REG_IMM_ADDR, FLOW_BRANCH, 0,          0)               /* jump if register value is at least immediate */ \
+    X(SPAWN,       0x3C, "spawn",    LAYOUT_REG_ADDR, FLOW_SPAWN,   0,            0)               /* start a thread at address with a copy of the registers, store its handle in register */ \
+    X(JOIN,        0x3D, "join",     LAYOUT_REG,      FLOW_NEXT,    0,            0)               /* wait for the thread whose handle is in register, store its ax in register */ \
+    X(LD,          0x3E, "ld",       LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* load register from the shared memory word addressed by register */ \
+    X(ST,          0x3F, "st",       LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* store register value into the shared memory word addressed by register */ \
+    X(XADD,        0x40, "xadd",     LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* atomically add register value to memory word, register receives the old value */ \
+    X(CAS,         0x41, "cas",      LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* atomically store register value into memory word if it equals ax, ax receives the old value */ \
+    X(FENCE,       0x42, "fence",    LAYOUT_NONE,     FLOW_NEXT,    0,            0)               /* full memory barrier between the accesses before and after */ \
+    X(SEND,        0x43, "send",     LAYOUT_REG_REG,  FLOW_NEXT,    0,            0)               /* send register value on the channel numbered by register, waiting while it is full */ \
+    X(RECV,        0x44, "recv",     LAYOUT_REG_REG_ADDR, FLOW_BRANCH, 0,          0)               /* receive into register from channel, waiting for a value, jump once it is closed and drained */ \
+    X(TRYRECV,     0x45, "tryrecv",  LAYOUT_REG_REG_ADDR, FLOW_BRANCH, 0,          0)               /* receive into register from channel, jump if nothing is waiting */ \
+    X(PRINTP,      0x46, "printp",   LAYOUT_ADDR,     FLOW_NEXT,    0,            0)               /* print the string pool entry at address with one write */ \
+    X(POOL,        0x47, "pool",     LAYOUT_POOL,     FLOW_STOP,    0,            0)               /* string pool the linker places after the code, never runs */ \
+    X(CALLW,       0x48, "callw",    LAYOUT_ADDR,     FLOW_CALL,    0,            0)               /* call a procedure in a new register window (the next r0-r10 in the register file, ax-dx carried over) */ \
+    X(RETW,        0x49, "retw",     LAYOUT_NONE,     FLOW_RETURN,  0,            0)               /* return from a callw to the caller's window, handing back ax-dx */ \
+    X(TRAP,        0xFF, "trap",     LAYOUT_NONE,     FLOW_NEXT,    0,            0)               /* stop and hand control to the debugger */
 
 typedef enum {
-    HR_R0               = 0x0d53ff3f,               // r0
-    HR_R1               = 0x0c53fdac,               // r1
-    HR_R2               = 0x0f540265,               // r2
-    HR_R3               = 0x0e5400d2,               // r3
-    HR_R4               = 0x0953f8f3,               // r4
-    HR_R5               = 0x0853f760,               // r5
-    HR_R6               = 0x0b53fc19,               // r6
-    HR_R7               = 0x0a53fa86,               // r7
-    HR_R8               = 0x15540bd7,               // r8
-    HR_R9               = 0x14540a44,               // r9
-    HR_R10              = 0x04383c94,               // r10
-    HR_AX               = 0x53250f3c,               // ax
-    HR_BX               = 0x552bce27,               // bx
-    HR_CX               = 0x4f29861e,               // cx
-    HR_DX               = 0x511cbd51,               // dx
-} HashedRegister;
\ No newline at end of file
+#define OPCODE_ENUM(name, value, mnemonic, layout, flow, pops, pushes) OP_##name = value,
+    OPCODES(OPCODE_ENUM)
+#undef OPCODE_ENUM
+} Opcode;
+
+typedef struct {
+    const char* mnemonic;
+    OperandLayout layout;
+    ControlFlow flow;
+    int pops;
+    int pushes;
+} InstructionInfo;
+
+// indexed by opcode, unused opcodes have a NULL mnemonic. defined in names.c
+extern const InstructionInfo instructionInfo[256];
+
+static inline int operandSize(OperandLayout layout) {
+    switch(layout) {
+        case LAYOUT_NONE: return 0;
+        case LAYOUT_REG: return 1;
+        case LAYOUT_REG_REG: return 2;
+        case LAYOUT_REG_IMM: return 3;
+        case LAYOUT_IMM: return 2;
+        case LAYOUT_ADDR: return 2;
+        case LAYOUT_REG_ADDR: return 3;
+        case LAYOUT_STRING: return 0;
+        case LAYOUT_HOST: return 1;
+        case LAYOUT_REL: return 1;
+        case LAYOUT_REG_REL: return 2;
+        case LAYOUT_REG_REG_ADDR: return 4;
+        case LAYOUT_REG_IMM_ADDR: return 5;
+        case LAYOUT_POOL: return 2;
+    }
+    return 0;
+}
+
+// offset of the absolute address operand from the opcode byte, 0 for layouts
+// without one
+static inline int addressOffset(OperandLayout layout) {
+    switch(layout) {
+        case LAYOUT_ADDR: return 1;
+        case LAYOUT_REG_ADDR: return 2;
+        case LAYOUT_REG_REG_ADDR: return 3;
+        case LAYOUT_REG_IMM_ADDR: return 4;
+        default: return 0;
+    }
+}
+
+// the short relative form of a branch, or 0 when it has none
+static inline uint8_t shortBranch(uint8_t opcode) {
+    switch(opcode) {
+        case OP_JMP: return OP_JMPS;
+        case OP_JNZ: return OP_JNZS;
+        case OP_JZ: return OP_JZS;
+        case OP_CALL: return OP_CALLS;
+        default: return 0;
+    }
+}
+
+// reach of a short branch, measured from the end of the instruction
+#define SHORT_BRANCH_MIN INT8_MIN
+#define SHORT_BRANCH_MAX INT8_MAX
+
+static inline uint8_t longBranch(uint8_t opcode) {
+    switch(opcode) {
+        case OP_JMPS: return OP_JMP;
+        case OP_JNZS: return OP_JNZ;
+        case OP_JZS: return OP_JZ;
+        case OP_CALLS: return OP_CALL;
+        default: return opcode;
+    }
+}
+
+// the form that prints its string from the pool, or 0 when the string stays inline
+static inline uint8_t pooledString(uint8_t opcode) {
+    return opcode == OP_PRINTCS ? OP_PRINTP : 0;
+}
+
+// the pool starts with a `pool` instruction holding the size of the entries
+// after it, each entry is a length followed by that many characters
+#define POOL_HEADER_SIZE 3
+#define POOL_LENGTH_SIZE 2
+
+// length of the instruction at offset including its opcode byte, strings are
+// measured up to and including their terminator and the pool by its size, or
+// up to the end of the source
+static inline int instructionLength(const uint8_t* source, int offset, int length) {
+    const InstructionInfo* info = &instructionInfo[source[offset]];
+    if(info->mnemonic == NULL) return 1;
+    if(info->layout == LAYOUT_POOL) {
+        if(offset + POOL_HEADER_SIZE > length) return length - offset;
+        int end = offset + POOL_HEADER_SIZE + ((source[offset + 1] << 8) | source[offset + 2]);
+        return (end < length ? end : length) - offset;
+    }
+    if(info->layout == LAYOUT_STRING) {
+        int end = offset + 1;
+        while(end < length && source[end] != 0x00) end++;
+        return (end < length ? end + 1 : end) - offset;
+    }
+    return 1 + operandSize(info->layout);
+}
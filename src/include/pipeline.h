@@ -0,0 +1,13 @@
+#pragma once
+
+#include "channel.h"
+#include "common.h"
+
+#define PIPELINE_MAX (CHANNEL_MAX - 1)
+
+// runs each image on its own thread for `synthetic -P`. stage n starts with
+// channel n in ax, which the stage before it sends on, and channel n + 1 in
+// bx, which the stage after it receives from. once a stage halts its output
+// channel is closed, so a recv in the next stage jumps when it has drained
+// the channel. the first stage's input is closed from the start.
+int runPipeline(uint8_t** images, int count);
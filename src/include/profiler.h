@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "common.h"
+#include "debuginfo.h"
+
+#define PROFILE_HZ 1000         // samples per second of cpu time
+#define PROFILE_DEPTH 4         // return addresses kept per sample
+#define PROFILE_PATHS 4096      // distinct call paths counted, power of two
+
+// sampling profiler for `synthetic -p`. a SIGPROF timer on the cpu time of
+// every thread running images records the instruction at that thread's vm.ip
+// and the calls whose return addresses are near the top of its stack, the
+// dispatch loop itself is not touched.
+void startProfiler(const uint8_t* image, size_t length);
+void stopProfiler();
+
+// hot addresses and call paths, named from info when it isn't NULL
+void writeProfile(FILE* file, DebugInfo* info);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+
+typedef struct {
+    uint32_t hash;
+    int length;
+    char chars[];
+} Symbol;
+
+typedef struct {
+    Symbol* key;
+    uint32_t value;
+    bool defined;
+} Entry;
+
+typedef struct {
+    int count;
+    int capacity;
+    Entry* entries;
+} Table;
+
+#define TABLE_MAX_LOAD 0.75
+
+uint32_t hashString(const char* chars, int length);
+
+void initTable(Table* table);
+void freeTable(Table* table);
+// frees every symbol interned in strings along with the table
+void freeSymbols(Table* strings);
+Entry* tableGet(Table* table, Symbol* key);
+Entry* tableSet(Table* table, Symbol* key, uint32_t value);
+Symbol* internSymbol(Table* strings, const char* chars, int length, uint32_t hash);
@@ -1,41 +1,100 @@
 #pragma once
 
+#include <stdatomic.h>
+#include <stdio.h>
+
 #include "common.h"
 #include "opcodes.h"
 
 #define NUM_REGS 15
 #define STACK_MAX 256
+#define MEMORY_WORDS 4096       // shared memory reached through ld, st and the atomics
+#define THREAD_MAX 256          // threads spawned and not yet joined
+#define WINDOW_MAX 256          // nested callw calls
+#define WINDOW_REGS 11          // r0-r10 belong to a window, ax-dx are shared by caller and callee
+
+// threads spawned under one run, run() waits for all of them before it returns
+typedef struct {
+    atomic_int pending;
+    atomic_int unjoined;        // spawned and not joined, run() frees their slots once they are done
+    atomic_int memoryTop;       // highest memoryTop of the threads that finished
+} ThreadGroup;
 
 typedef struct {
     uint8_t* source;
     uint16_t ip;
     uint8_t secip;
-    uint16_t regs[NUM_REGS];
+    uint16_t* regs;             // the open window's r0-r10 followed by ax-dx, inside registerFile
     uint16_t stack[STACK_MAX];
     uint16_t* stackTop; 
+    // callw moves regs up by WINDOW_REGS, so the caller's ax-dx become the
+    // callee's r0-r3 and the caller's r0-r10 are left where they are
+    uint16_t registerFile[WINDOW_MAX * WINDOW_REGS + NUM_REGS];
+    uint16_t returns[WINDOW_MAX];       // where retw goes for each open window
+    int windowCount;
+    int windowTop;              // deepest windowCount reached, the register file above it is still clear
+    FILE* out;                  // where the print instructions write
+    _Atomic uint16_t* memory;   // MEMORY_WORDS words shared with spawned threads
+    int memoryTop;              // one past the highest word stored to, run() adds its threads' stores
+    ThreadGroup* group;
 } VM;
 
+// register name and encoding, shared by the assembler and disassembler
+#define REGISTERS(X) \
+    X(r0,   "r0",   0x00) \
+    X(r1,   "r1",   0x01) \
+    X(r2,   "r2",   0x02) \
+    X(r3,   "r3",   0x03) \
+    X(r4,   "r4",   0x04) \
+    X(r5,   "r5",   0x05) \
+    X(r6,   "r6",   0x06) \
+    X(r7,   "r7",   0x07) \
+    X(r8,   "r8",   0x08) \
+    X(r9,   "r9",   0x09) \
+    X(r10,  "r10",  0x0A) \
+    X(ax,   "ax",   0x0B) \
+    X(bx,   "bx",   0x0C) \
+    X(cx,   "cx",   0x0D) \
+    X(dx,   "dx",   0x0E)
+
 typedef enum {
-    r0 = 0x00,
-    r1 = 0x01,
-    r2 = 0x02,
-    r3 = 0x03,
-    r4 = 0x04,
-    r5 = 0x05,
-    r6 = 0x06,
-    r7 = 0x07,
-    r8 = 0x08,
-    r9 = 0x09,
-    r10 = 0x0A,
-    ax = 0x0B,
-    bx = 0x0C,
-    cx = 0x0D,
-    dx = 0x0E,
+#define REGISTER_ENUM(name, string, value) name = value,
+    REGISTERS(REGISTER_ENUM)
+#undef REGISTER_ENUM
 } Registers;
 
+// assembly names of the registers, defined in names.c
+extern const char* registerNames[NUM_REGS];
+
 #define VALID_REGISTER(reg) \
     (reg <= (NUM_REGS - 1))
 
+typedef void (*HostFunction)(VM* vm);
+
+// runs when a trap is hit outside the debugger. returns true after putting
+// back the instruction the trap was patched over, execution goes on there.
+typedef bool (*TrapHandler)(uint16_t address);
+
+// runs on a thread other than the main one when it starts running images and
+// when it is done with them, for the workers behind spawn and batch mode
+typedef void (*ThreadHook)(bool started);
+
+typedef enum {
+    VM_HALT,                    // the image executed `halt`
+    VM_TRAP,                    // stopped on a trap, vm.ip is the address of the trap
+} VMStatus;
+
+// one per thread, so batch workers each run their own copy of the machine
+extern _Thread_local VM vm;
+
 void initVM();
 void freeVM();
-void run(uint8_t* source);
\ No newline at end of file
+VMStatus run(uint8_t* source);
+VMStatus resume();
+void registerHostFunction(uint8_t index, HostFunction function);
+void setTrapHandler(TrapHandler handler);
+void setThreadSource(uint8_t* source);
+void setThreadHook(ThreadHook hook);
+void announceThread(bool started);
+void resetRegisters();
+void registerBuiltinHostFunctions();
\ No newline at end of file
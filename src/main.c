@@ -1,10 +1,17 @@
 #include <getopt.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include "batch.h"
 #include "common.h"
+#include "coverage.h"
 #include "debug.h"
+#include "debugger.h"
+#include "pipeline.h"
+#include "profiler.h"
 #include "vm.h"
 
 #ifndef SYNTHETIC_VERSION
@@ -17,27 +24,29 @@ bool file_exists(char *filename) {
 }
 
 void print_usage(char** argv) {
-    fprintf(stderr, "usage: %s [image]\n", argv[0]);
+    fprintf(stderr, "usage: %s [-d] [-p profile] [-c coverage] [-b records [-l] [-j jobs]] [image]\n", argv[0]);
+    fprintf(stderr, "       %s -P image image...\n", argv[0]);
+    fprintf(stderr, "    -d    run the image under the interactive debugger\n");
+    fprintf(stderr, "    -p    sample the running image and write a profile when it exits\n");
+    fprintf(stderr, "    -c    merge the basic blocks the image runs into a coverage file\n");
+    fprintf(stderr, "    -b    run the image once per record in a file, - reads stdin\n");
+    fprintf(stderr, "    -l    records are a 16-bit big endian length and that many bytes\n");
+    fprintf(stderr, "    -j    threads running records, defaults to the number of online cpus\n");
+    fprintf(stderr, "    -P    run the images as pipeline stages joined by channels\n");
 }
 
-int main(int argc, char** argv) {
-    //printf("Synthetic Virtual Machine %s\n", SYNTHETIC_VERSION);
-    
-    if(argc == 1) {
-        print_usage(argv);
-        return 1;
-    }
-
-    if(!file_exists(argv[1])) {
-        fprintf(stderr, "image file `%s` does not exist.\n", argv[1]);
-        return 1;
+// the whole file plus a terminator, NULL after reporting why it couldn't be read
+static uint8_t* loadImage(const char* path, size_t* length) {
+    if(!file_exists((char*)path)) {
+        fprintf(stderr, "image file `%s` does not exist.\n", path);
+        return NULL;
     }
 
-    FILE* file = fopen(argv[1], "rb");
+    FILE* file = fopen(path, "rb");
 
     if(file == NULL) {
-        fprintf(stderr, "error opening image file `%s`.\n", argv[1]);
-        return 1;
+        fprintf(stderr, "error opening image file `%s`.\n", path);
+        return NULL;
     }
 
     fseek(file, 0L, SEEK_END);
@@ -46,23 +55,153 @@ int main(int argc, char** argv) {
 
     uint8_t* buffer = (uint8_t*)malloc(fileSize + 1);
     if(buffer == NULL) {
-        fprintf(stderr, "error allocating memory to read `%s`.\n", argv[1]);
-        return 1;
+        fprintf(stderr, "error allocating memory to read `%s`.\n", path);
+        return NULL;
     }
 
     size_t bytesRead = fread(buffer, sizeof(uint8_t), fileSize, file);
     if(bytesRead < fileSize) {
-        fprintf(stderr, "error reading file `%s`.\n", argv[1]);
-        return 1;
+        fprintf(stderr, "error reading file `%s`.\n", path);
+        return NULL;
     }
 
     buffer[bytesRead] = '\0';
 
     fclose(file);
+    *length = bytesRead;
+    return buffer;
+}
+
+static const char* profilePath = NULL;
+static DebugInfo* profileInfo = NULL;
+
+// runs on halt and on every exit(1) the VM takes on an error
+static void finishProfile() {
+    stopProfiler();
+    FILE* file = fopen(profilePath, "w");
+    if(file == NULL) {
+        fprintf(stderr, "error opening profile file `%s`.\n", profilePath);
+        return;
+    }
+    writeProfile(file, profileInfo);
+    fclose(file);
+}
+
+static const char* coveragePath = NULL;
+
+static void writeCoverage() {
+    finishCoverage(coveragePath);
+}
+
+int main(int argc, char** argv) {
+    //printf("Synthetic Virtual Machine %s\n", SYNTHETIC_VERSION);
+    
+    bool debug = false;
+    bool pipeline = false;
+    const char* recordsPath = NULL;
+    RecordFormat format = RECORDS_LINES;
+    int jobs = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "dp:c:b:lj:P")) != -1) {
+        switch(opt) {
+            case 'd': debug = true; break;
+            case 'p': profilePath = optarg; break;
+            case 'c': coveragePath = optarg; break;
+            case 'b': recordsPath = optarg; break;
+            case 'l': format = RECORDS_LENGTH; break;
+            case 'j': jobs = atoi(optarg); break;
+            case 'P': pipeline = true; break;
+            default:
+                print_usage(argv);
+                return 1;
+        }
+    }
+
+    if(pipeline) {
+        if(debug || recordsPath != NULL || profilePath != NULL || coveragePath != NULL || optind == argc) {
+            print_usage(argv);
+            return 1;
+        }
+        int count = argc - optind;
+        uint8_t** images = malloc(sizeof(uint8_t*) * count);
+        if(images == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            return 1;
+        }
+        for(int i = 0; i < count; i++) {
+            size_t length;
+            images[i] = loadImage(argv[optind + i], &length);
+            if(images[i] == NULL) return 1;
+        }
+        initVM();
+        return runPipeline(images, count);
+    }
+
+    if(optind != argc - 1) {
+        print_usage(argv);
+        return 1;
+    }
+    char* path = argv[optind];
+
+    if(debug && recordsPath != NULL) {
+        fprintf(stderr, "-d and -b cannot be used together.\n");
+        return 1;
+    }
+    if(debug && coveragePath != NULL) {
+        fprintf(stderr, "-d and -c cannot be used together.\n");
+        return 1;
+    }
+
+    size_t bytesRead;
+    uint8_t* buffer = loadImage(path, &bytesRead);
+    if(buffer == NULL) return 1;
+
+    // `synas -g` leaves line tables next to the image
+    char debugPath[PATH_MAX];
+    DebugInfo debugInfo;
+    snprintf(debugPath, sizeof(debugPath), "%s.sdbg", path);
+    bool hasDebugInfo = file_exists(debugPath) && loadDebugInfo(debugPath, &debugInfo);
+    if(hasDebugInfo)
+        setDebugInfo(&debugInfo);
 
     initVM();
 
-    run(buffer);
+    if(debug)
+        return debugImage(buffer, bytesRead, hasDebugInfo ? &debugInfo : NULL);
+
+    if(profilePath != NULL) {
+        profileInfo = hasDebugInfo ? &debugInfo : NULL;
+        startProfiler(buffer, bytesRead);
+        atexit(finishProfile);
+    }
+
+    // the profiler maps instructions from the image as loaded, before traps go in
+    if(coveragePath != NULL) {
+        buffer = startCoverage(buffer, bytesRead);
+        atexit(writeCoverage);
+    }
+
+    if(recordsPath != NULL) {
+        FILE* records = strcmp(recordsPath, "-") == 0 ? stdin : fopen(recordsPath, "rb");
+        if(records == NULL) {
+            fprintf(stderr, "error opening records file `%s`.\n", recordsPath);
+            return 1;
+        }
+        if(jobs <= 0) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            jobs = cpus > 0 ? (int)cpus : 1;
+        }
+        int result = runBatch(buffer, records, format, jobs);
+        if(records != stdin) fclose(records);
+        freeVM();
+        return result;
+    }
+
+    if(run(buffer) == VM_TRAP) {
+        fflush(stdout);
+        fprintf(stderr, "trap at 0x%04x without a debugger.\n", vm.ip);
+        return 1;
+    }
     freeVM();
     return 0;
 }
\ No newline at end of file
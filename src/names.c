@@ -0,0 +1,24 @@
+#include "host.h"
+#include "opcodes.h"
+#include "vm.h"
+
+// names and tables shared by the VM, the tools and the assembler, which
+// doesn't link host.c since the host functions need the VM
+
+const InstructionInfo instructionInfo[256] = {
+#define OPCODE_INFO(name, value, mnemonic, layout, flow, pops, pushes) [value] = { mnemonic, layout, flow, pops, pushes },
+    OPCODES(OPCODE_INFO)
+#undef OPCODE_INFO
+};
+
+const char* hostFunctionNames[HOST_BUILTIN_COUNT] = {
+#define HOST_NAME(id, name) name,
+    HOST_FUNCTIONS(HOST_NAME)
+#undef HOST_NAME
+};
+
+const char* registerNames[NUM_REGS] = {
+#define REGISTER_NAME(name, string, value) [value] = string,
+    REGISTERS(REGISTER_NAME)
+#undef REGISTER_NAME
+};
@@ -0,0 +1,58 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include "pipeline.h"
+#include "vm.h"
+
+typedef struct {
+    uint8_t* image;
+    uint16_t input;
+    uint16_t output;
+} Stage;
+
+// every stage is a separate program, so each gets its own memory
+static void* runStage(void* arg) {
+    Stage* stage = (Stage*)arg;
+    vm.out = stdout;
+    vm.memory = calloc(MEMORY_WORDS, sizeof(uint16_t));
+    if(vm.memory == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    resetRegisters();
+    vm.stackTop = vm.stack;
+    vm.regs[ax] = stage->input;
+    vm.regs[bx] = stage->output;
+
+    if(run(stage->image) == VM_TRAP) {
+        fflush(stdout);
+        fprintf(stderr, "stage %d: trap at 0x%04x without a debugger.\n", stage->input, vm.ip);
+        exit(1);
+    }
+    closeChannel(stage->output);
+    free((void*)vm.memory);
+    return NULL;
+}
+
+int runPipeline(uint8_t** images, int count) {
+    if(count > PIPELINE_MAX) {
+        fprintf(stderr, "a pipeline has at most %d stages.\n", PIPELINE_MAX);
+        return 1;
+    }
+
+    Stage stages[count];
+    pthread_t threads[count];
+    closeChannel(0);
+    for(int i = 0; i < count; i++) {
+        stages[i].image = images[i];
+        stages[i].input = (uint16_t)i;
+        stages[i].output = (uint16_t)(i + 1);
+        if(pthread_create(&threads[i], NULL, runStage, &stages[i]) != 0) {
+            fprintf(stderr, "error starting pipeline thread.\n");
+            exit(1);
+        }
+    }
+    for(int i = 0; i < count; i++)
+        pthread_join(threads[i], NULL);
+    return 0;
+}
@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "opcodes.h"
+#include "profiler.h"
+#include "vm.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// everything the signal handler touches is allocated before the timer is
+// armed, so taking a sample is a few loads and stores. every thread that runs
+// images has its own cpu time timer signalling only that thread, so a sample
+// always reads the vm of the thread that spent the time. threads sample at
+// once, the counters are atomic and the call path table takes a spinlock.
+
+#define ADDRESS_SPACE 65536
+#define SCAN_LIMIT 16           // stack slots searched for return addresses
+#define REPORT_ROWS 20
+
+typedef struct {
+    uint16_t frames[PROFILE_DEPTH + 1];     // ip first, then return addresses
+    uint8_t depth;
+    uint32_t count;
+} CallPath;
+
+typedef struct {
+    uint8_t* returnSites;       // 1 where an address follows a call
+    uint16_t* owners;           // start of the instruction covering each address
+    _Atomic uint32_t* hits;     // samples per ip
+    CallPath* paths;
+    atomic_flag pathsLock;
+    atomic_uint samples;
+    atomic_uint dropped;
+    atomic_bool stopped;
+} Profiler;
+
+static Profiler profiler = { .pathsLock = ATOMIC_FLAG_INIT };
+
+static _Thread_local timer_t threadTimer;
+static _Thread_local bool timerArmed;
+
+// maps every address to the instruction covering it. the stack mixes data
+// with return addresses, a value counts as one when a call ends right before it
+static void markInstructions(const uint8_t* image, size_t length) {
+    for(uint32_t address = 0; address < ADDRESS_SPACE; address++)
+        profiler.owners[address] = (uint16_t)address;
+
+    for(size_t offset = 0; offset < length && offset < ADDRESS_SPACE;) {
+        size_t next = offset + instructionLength(image, (int)offset, (int)length);
+        for(size_t address = offset; address < next && address < ADDRESS_SPACE; address++)
+            profiler.owners[address] = (uint16_t)offset;
+        uint8_t opcode = image[offset];
+        if((opcode == OP_CALL || opcode == OP_CALLS) && next < ADDRESS_SPACE)
+            profiler.returnSites[next] = 1;
+        offset = next;
+    }
+}
+
+// vm.ip is somewhere past the opcode of the instruction being run, or just
+// past the end of the one that finished. either way the byte before it
+// belongs to the instruction the time went to.
+static uint16_t instructionBefore(uint16_t address) {
+    return address > 0 ? profiler.owners[address - 1] : 0;
+}
+
+static uint32_t hashPath(const uint16_t* frames, int depth) {
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i <= depth; i++) {
+        hash ^= frames[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static void takeSample(int signal) {
+    (void)signal;
+    // a batch or pool thread between images, none of its time is the image's
+    if(vm.source == NULL || atomic_load_explicit(&profiler.stopped, memory_order_relaxed)) return;
+
+    uint16_t frames[PROFILE_DEPTH + 1];
+    int depth = 0;
+    frames[0] = instructionBefore(vm.ip);
+
+    int top = (int)(vm.stackTop - vm.stack);
+    int limit = top > SCAN_LIMIT ? top - SCAN_LIMIT : 0;
+    for(int slot = top - 1; slot >= limit && depth < PROFILE_DEPTH; slot--) {
+        if(profiler.returnSites[vm.stack[slot]]) frames[++depth] = instructionBefore(vm.stack[slot]);
+    }
+
+    atomic_fetch_add_explicit(&profiler.samples, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&profiler.hits[frames[0]], 1, memory_order_relaxed);
+
+    // only held by another thread's handler, which never waits on anything
+    while(atomic_flag_test_and_set_explicit(&profiler.pathsLock, memory_order_acquire));
+    uint32_t index = hashPath(frames, depth) & (PROFILE_PATHS - 1);
+    for(int probe = 0; probe < PROFILE_PATHS; probe++) {
+        CallPath* path = &profiler.paths[index];
+        if(path->count == 0) {
+            memcpy(path->frames, frames, sizeof(uint16_t) * (depth + 1));
+            path->depth = (uint8_t)depth;
+        }
+        if(path->depth == depth && memcmp(path->frames, frames, sizeof(uint16_t) * (depth + 1)) == 0) {
+            path->count++;
+            atomic_flag_clear_explicit(&profiler.pathsLock, memory_order_release);
+            return;
+        }
+        index = (index + 1) & (PROFILE_PATHS - 1);
+    }
+    atomic_flag_clear_explicit(&profiler.pathsLock, memory_order_release);
+    atomic_fetch_add_explicit(&profiler.dropped, 1, memory_order_relaxed);
+}
+
+// samples the calling thread's cpu time, not the whole process's
+static void armTimer() {
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = gettid();
+    if(timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &threadTimer) < 0) {
+        fprintf(stderr, "error creating the profiling timer.\n");
+        exit(1);
+    }
+
+    struct itimerspec timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_nsec = 1000000000 / PROFILE_HZ;
+    timer.it_value = timer.it_interval;
+    if(timer_settime(threadTimer, 0, &timer, NULL) < 0) {
+        fprintf(stderr, "error starting the profiling timer.\n");
+        exit(1);
+    }
+    timerArmed = true;
+}
+
+static void disarmTimer() {
+    if(!timerArmed) return;
+    timer_delete(threadTimer);
+    timerArmed = false;
+}
+
+static void profileThread(bool started) {
+    if(started) armTimer();
+    else disarmTimer();
+}
+
+void startProfiler(const uint8_t* image, size_t length) {
+    profiler.returnSites = calloc(ADDRESS_SPACE, sizeof(uint8_t));
+    profiler.hits = calloc(ADDRESS_SPACE, sizeof(_Atomic uint32_t));
+    profiler.owners = malloc(sizeof(uint16_t) * ADDRESS_SPACE);
+    profiler.paths = calloc(PROFILE_PATHS, sizeof(CallPath));
+    if(profiler.returnSites == NULL || profiler.owners == NULL || profiler.hits == NULL || profiler.paths == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    markInstructions(image, length);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = takeSample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if(sigaction(SIGPROF, &action, NULL) < 0) {
+        fprintf(stderr, "error installing the profiling signal handler.\n");
+        exit(1);
+    }
+
+    setThreadHook(profileThread);
+    armTimer();
+}
+
+// threads still running keep their timers, their samples are ignored
+void stopProfiler() {
+    atomic_store(&profiler.stopped, true);
+    disarmTimer();
+    signal(SIGPROF, SIG_IGN);
+}
+
+static void printLocation(FILE* file, uint16_t address, DebugInfo* info) {
+    fprintf(file, "0x%04x", address);
+    if(info == NULL) return;
+
+    const DebugLabel* label = lookupLabel(info, address);
+    if(label != NULL) {
+        if(label->address == address) fprintf(file, " %s", label->name);
+        else fprintf(file, " %s+0x%x", label->name, address - label->address);
+    }
+    const LineRow* row = lookupLine(info, address);
+    if(row != NULL && row->file < info->fileCount)
+        fprintf(file, " (%s:%u)", info->files[row->file], row->line);
+}
+
+static int compareHits(const void* a, const void* b) {
+    uint32_t left = profiler.hits[*(const uint16_t*)a];
+    uint32_t right = profiler.hits[*(const uint16_t*)b];
+    if(left != right) return left < right ? 1 : -1;
+    return *(const uint16_t*)a - *(const uint16_t*)b;
+}
+
+static int comparePaths(const void* a, const void* b) {
+    const CallPath* left = a;
+    const CallPath* right = b;
+    if(left->count != right->count) return left->count < right->count ? 1 : -1;
+    return 0;
+}
+
+void writeProfile(FILE* file, DebugInfo* info) {
+    uint32_t samples = atomic_load(&profiler.samples);
+    uint32_t dropped = atomic_load(&profiler.dropped);
+    fprintf(file, "profile: %u samples at %d Hz", samples, PROFILE_HZ);
+    if(dropped > 0) fprintf(file, ", %u call paths not counted", dropped);
+    fprintf(file, "\n");
+    if(samples == 0) return;
+
+    uint16_t* addresses = malloc(sizeof(uint16_t) * ADDRESS_SPACE);
+    if(addresses == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+    int count = 0;
+    for(int address = 0; address < ADDRESS_SPACE; address++)
+        if(profiler.hits[address] > 0) addresses[count++] = (uint16_t)address;
+    qsort(addresses, count, sizeof(uint16_t), compareHits);
+
+    fprintf(file, "\nhot addresses\n  samples       %%  address\n");
+    for(int i = 0; i < count && i < REPORT_ROWS; i++) {
+        uint32_t hits = profiler.hits[addresses[i]];
+        fprintf(file, "  %7u  %5.1f%%  ", hits, 100.0 * hits / samples);
+        printLocation(file, addresses[i], info);
+        fprintf(file, "\n");
+    }
+    free(addresses);
+
+    qsort(profiler.paths, PROFILE_PATHS, sizeof(CallPath), comparePaths);
+    fprintf(file, "\ncall paths, innermost first, callers shown at their call\n  samples       %%  path\n");
+    for(int i = 0; i < PROFILE_PATHS && i < REPORT_ROWS && profiler.paths[i].count > 0; i++) {
+        CallPath* path = &profiler.paths[i];
+        fprintf(file, "  %7u  %5.1f%%  ", path->count, 100.0 * path->count / samples);
+        for(int frame = 0; frame <= path->depth; frame++) {
+            if(frame > 0) fprintf(file, " <- ");
+            printLocation(file, path->frames[frame], info);
+        }
+        fprintf(file, "\n");
+    }
+}
@@ -0,0 +1,107 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "common.h"
+#include "debuginfo.h"
+
+// control flow graph and static cost report for images
+//
+// every function gets its block and instruction counts, its natural loops,
+// the deepest the stack gets while it runs and the number of instructions
+// dispatched on its longest path with each loop taken once.
+
+static void printUsage(char** argv) {
+    fprintf(stderr, "usage: %s [-o graph.dot] image\n", argv[0]);
+    fprintf(stderr, "    -o    write the graph in graphviz dot format\n");
+}
+
+static void printReport(ControlFlowGraph* graph, DebugInfo* info) {
+    for(int i = 0; i < graph->functionCount; i++) {
+        Function* function = &graph->functions[i];
+        uint32_t instructions = 0;
+        for(int j = 0; j < function->blockCount; j++)
+            instructions += graph->blocks[function->blocks[j]].instructions;
+
+        printFunctionName(stdout, graph, function->entry, info);
+        printf(" at 0x%04x\n", function->entry);
+        printf("    blocks        %d\n", function->blockCount);
+        printf("    instructions  %u\n", instructions);
+        printf("    max stack     %d%s\n", function->maxStack, function->stackUnbounded ? " (unbounded)" : "");
+        printf("    cost          %u\n", function->cost);
+        if(function->recursive) printf("    recursive\n");
+        if(function->usesHost) printf("    calls the host, stack effect unknown\n");
+        for(int j = 0; j < function->loopCount; j++) {
+            Loop* loop = &function->loops[j];
+            printf("    loop at 0x%04x, %d block%s\n", graph->blocks[loop->header].start,
+                loop->blockCount, loop->blockCount == 1 ? "" : "s");
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* output = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "o:")) != -1) {
+        switch(opt) {
+            case 'o': output = optarg; break;
+            default:
+                printUsage(argv);
+                return 1;
+        }
+    }
+    if(optind != argc - 1) {
+        printUsage(argv);
+        return 1;
+    }
+    const char* path = argv[optind];
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "image file `%s` does not exist.\n", path);
+        return 1;
+    }
+    uint32_t length = (uint32_t)st.st_size;
+    const uint8_t* source = NULL;
+    if(length > 0) {
+        source = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(source == MAP_FAILED) {
+            fprintf(stderr, "error mapping image file `%s`.\n", path);
+            return 1;
+        }
+    }
+    close(fd);
+
+    DebugInfo info;
+    bool haveInfo = false;
+    char debugPath[PATH_MAX];
+    snprintf(debugPath, sizeof(debugPath), "%s.sdbg", path);
+    if(access(debugPath, R_OK) == 0) haveInfo = loadDebugInfo(debugPath, &info);
+
+    ControlFlowGraph graph;
+    buildGraph(&graph, source, length);
+    analyzeFunctions(&graph);
+    printReport(&graph, haveInfo ? &info : NULL);
+
+    if(output != NULL) {
+        FILE* file = fopen(output, "w");
+        if(file == NULL) {
+            fprintf(stderr, "error opening output file `%s`.\n", output);
+            return 1;
+        }
+        writeDot(&graph, file, haveInfo ? &info : NULL);
+        fclose(file);
+    }
+
+    freeGraph(&graph);
+    if(haveInfo) freeDebugInfo(&info);
+    if(source != NULL) munmap((void*)source, length);
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "common.h"
+#include "covmap.h"
+#include "debuginfo.h"
+
+// merges coverage files written by `synthetic -c` and reports them against
+// the sources the image was assembled from
+//
+// blocks are mapped to lines through `image.sdbg`, a line is hit when any
+// instruction assembled from it ran.
+
+static void printUsage(char** argv) {
+    fprintf(stderr, "usage: %s [-o report.info] [-m merged] image coverage...\n", argv[0]);
+    fprintf(stderr, "    -o    write line and function coverage in lcov tracefile format\n");
+    fprintf(stderr, "    -m    write the merged coverage file\n");
+}
+
+int main(int argc, char** argv) {
+    const char* output = NULL;
+    const char* merged = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "o:m:")) != -1) {
+        switch(opt) {
+            case 'o': output = optarg; break;
+            case 'm': merged = optarg; break;
+            default:
+                printUsage(argv);
+                return 1;
+        }
+    }
+    if(argc - optind < 2) {
+        printUsage(argv);
+        return 1;
+    }
+    const char* path = argv[optind];
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "image file `%s` does not exist.\n", path);
+        return 1;
+    }
+    uint32_t length = (uint32_t)st.st_size;
+    const uint8_t* source = NULL;
+    if(length > 0) {
+        source = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(source == MAP_FAILED) {
+            fprintf(stderr, "error mapping image file `%s`.\n", path);
+            return 1;
+        }
+    }
+    close(fd);
+
+    DebugInfo info;
+    bool haveInfo = false;
+    char debugPath[PATH_MAX];
+    snprintf(debugPath, sizeof(debugPath), "%s.sdbg", path);
+    if(access(debugPath, R_OK) == 0) haveInfo = loadDebugInfo(debugPath, &info);
+    if(output != NULL && !haveInfo) {
+        fprintf(stderr, "`%s` has no debug info, assemble it with `synas -g` for line coverage.\n", path);
+        return 1;
+    }
+
+    ControlFlowGraph graph;
+    buildGraph(&graph, source, length);
+
+    CoverageMap map;
+    initCoverageMap(&map, source, length, (uint32_t)graph.blockCount);
+    for(int i = optind + 1; i < argc; i++) {
+        CoverageMap run;
+        if(!readCoverageMap(argv[i], &run)) return 1;
+        if(!mergeCoverageMap(&map, &run)) {
+            fprintf(stderr, "coverage file `%s` was written for a different image.\n", argv[i]);
+            return 1;
+        }
+        freeCoverageMap(&run);
+    }
+
+    writeCoverageSummary(stdout, &graph, &map, haveInfo ? &info : NULL);
+
+    if(output != NULL) {
+        FILE* file = fopen(output, "w");
+        if(file == NULL) {
+            fprintf(stderr, "error opening output file `%s`.\n", output);
+            return 1;
+        }
+        writeLcov(file, &graph, &map, &info);
+        fclose(file);
+    }
+    if(merged != NULL && !writeCoverageMap(merged, &map)) return 1;
+
+    freeCoverageMap(&map);
+    freeGraph(&graph);
+    if(haveInfo) freeDebugInfo(&info);
+    if(source != NULL) munmap((void*)source, length);
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+
+#include "common.h"
+#include "object.h"
+#include "opcodes.h"
+#include "vm.h"
+
+// writes the instruction set as a python module
+//
+// syncc encodes images itself, and takes opcodes, operand layouts, short
+// branch forms and their reach, the pooled form of strings, the pool layout
+// and register numbers from this module so they always match the table and
+// rules the assembler, linker and VM are built from.
+
+static const char* layoutNames[] = {
+    [LAYOUT_NONE] = "NONE",
+    [LAYOUT_REG] = "REG",
+    [LAYOUT_REG_REG] = "REG_REG",
+    [LAYOUT_REG_IMM] = "REG_IMM",
+    [LAYOUT_IMM] = "IMM",
+    [LAYOUT_ADDR] = "ADDR",
+    [LAYOUT_REG_ADDR] = "REG_ADDR",
+    [LAYOUT_STRING] = "STRING",
+    [LAYOUT_HOST] = "HOST",
+    [LAYOUT_REL] = "REL",
+    [LAYOUT_REG_REL] = "REG_REL",
+    [LAYOUT_REG_REG_ADDR] = "REG_REG_ADDR",
+    [LAYOUT_REG_IMM_ADDR] = "REG_IMM_ADDR",
+    [LAYOUT_POOL] = "POOL",
+};
+
+int main(void) {
+    printf("# generated by synisa from opcodes.h, do not edit\n\n");
+    printf("ENTRY_SIZE = %d\n\n", ENTRY_SIZE);
+
+    printf("# mnemonic: (opcode, operand layout)\n");
+    printf("OPCODES = {\n");
+    for(int opcode = 0; opcode < 256; opcode++) {
+        const InstructionInfo* info = &instructionInfo[opcode];
+        if(info->mnemonic != NULL)
+            printf("    \"%s\": (0x%02x, \"%s\"),\n", info->mnemonic, opcode, layoutNames[info->layout]);
+    }
+    printf("}\n\n");
+
+    printf("# bytes after the opcode, strings add their characters and terminator\n");
+    printf("OPERAND_SIZES = {\n");
+    for(size_t layout = 0; layout < sizeof(layoutNames) / sizeof(layoutNames[0]); layout++)
+        printf("    \"%s\": %d,\n", layoutNames[layout], operandSize((OperandLayout)layout));
+    printf("}\n\n");
+
+    printf("# long branch mnemonic: short form with a signed 8-bit displacement\n");
+    printf("SHORT_BRANCHES = {\n");
+    for(int opcode = 0; opcode < 256; opcode++) {
+        if(instructionInfo[opcode].mnemonic != NULL && shortBranch((uint8_t)opcode))
+            printf("    \"%s\": \"%s\",\n", instructionInfo[opcode].mnemonic, instructionInfo[shortBranch((uint8_t)opcode)].mnemonic);
+    }
+    printf("}\n\n");
+
+    printf("SHORT_BRANCH_MIN = %d\n", SHORT_BRANCH_MIN);
+    printf("SHORT_BRANCH_MAX = %d\n\n", SHORT_BRANCH_MAX);
+
+    printf("# inline string mnemonic: form printing the string from the pool\n");
+    printf("POOLED_STRINGS = {\n");
+    for(int opcode = 0; opcode < 256; opcode++) {
+        if(instructionInfo[opcode].mnemonic != NULL && pooledString((uint8_t)opcode))
+            printf("    \"%s\": \"%s\",\n", instructionInfo[opcode].mnemonic, instructionInfo[pooledString((uint8_t)opcode)].mnemonic);
+    }
+    printf("}\n\n");
+
+    printf("# the pool instruction and its size, then a length before each string\n");
+    printf("POOL_HEADER_SIZE = %d\n", POOL_HEADER_SIZE);
+    printf("POOL_LENGTH_SIZE = %d\n\n", POOL_LENGTH_SIZE);
+
+    printf("REGISTERS = {\n");
+    for(int reg = 0; reg < NUM_REGS; reg++)
+        printf("    \"%s\": 0x%02x,\n", registerNames[reg], reg);
+    printf("}\n");
+    return 0;
+}
@@ -0,0 +1,496 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "debuginfo.h"
+#include "host.h"
+#include "object.h"
+#include "opcodes.h"
+#include "vm.h"
+
+// linear-sweep disassembler for images
+//
+// every instruction is sized from the opcode table, so the sweep never drifts
+// out of step. output is formatted by hand into one large buffer because
+// printf per token dominates on multi-megabyte images.
+
+#define OUTPUT_SIZE (1 << 20)
+#define BYTES_SHOWN 6           // enough for the longest fixed-size instruction
+
+typedef struct {
+    FILE* file;
+    size_t count;
+    char data[OUTPUT_SIZE];
+} Output;
+
+typedef struct {
+    const uint8_t* source;
+    uint32_t length;
+    DebugInfo info;             // labels come from `.sdbg` or are made up
+    bool labels;
+    bool sasm;
+    bool lossy;                 // something in the image can't be written as source
+    Output* out;
+} Disassembler;
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static void flushOutput(Output* out) {
+    if(out->count > 0 && fwrite(out->data, 1, out->count, out->file) < out->count) {
+        fprintf(stderr, "error writing output.\n");
+        exit(1);
+    }
+    out->count = 0;
+}
+
+static void putChars(Output* out, const char* chars, size_t length) {
+    if(out->count + length > OUTPUT_SIZE) {
+        flushOutput(out);
+        if(length > OUTPUT_SIZE) {
+            fwrite(chars, 1, length, out->file);
+            return;
+        }
+    }
+    memcpy(out->data + out->count, chars, length);
+    out->count += length;
+}
+
+static void putChar(Output* out, char c) {
+    if(out->count == OUTPUT_SIZE) flushOutput(out);
+    out->data[out->count++] = c;
+}
+
+static void putString(Output* out, const char* string) {
+    putChars(out, string, strlen(string));
+}
+
+static void putHex(Output* out, uint32_t value, int digits) {
+    char buffer[8];
+    for(int i = digits - 1; i >= 0; i--) {
+        buffer[i] = hexDigits[value & 0xF];
+        value >>= 4;
+    }
+    putChars(out, buffer, digits);
+}
+
+static void putAddress(Output* out, uint32_t value) {
+    putChars(out, "0x", 2);
+    putHex(out, value, value > 0xFFFF ? 8 : 4);
+}
+
+static void putPadding(Output* out, int count) {
+    for(int i = 0; i < count; i++) putChar(out, ' ');
+}
+
+static uint16_t getOperand16(const uint8_t* source, uint32_t offset) {
+    return (uint16_t)((source[offset] << 8) | source[offset + 1]);
+}
+
+static void putRegister(Disassembler* disassembler, uint8_t reg) {
+    if(VALID_REGISTER(reg)) {
+        putString(disassembler->out, registerNames[reg]);
+    } else {
+        putString(disassembler->out, "(nil)");
+        disassembler->lossy = true;
+    }
+}
+
+static const DebugLabel* labelAt(Disassembler* disassembler, uint32_t address) {
+    if(!disassembler->labels) return NULL;
+    const DebugLabel* label = lookupLabel(&disassembler->info, address);
+    return (label != NULL && label->address == address) ? label : NULL;
+}
+
+// branch targets are shown by label when one marks them, source output uses
+// the label alone so the assembler can place it again
+static void putTarget(Disassembler* disassembler, uint32_t address) {
+    const DebugLabel* label = labelAt(disassembler, address);
+    if(disassembler->sasm) {
+        if(label != NULL) putString(disassembler->out, label->name);
+        else putAddress(disassembler->out, address);
+        return;
+    }
+
+    putAddress(disassembler->out, address);
+    if(label != NULL) {
+        putChars(disassembler->out, " <", 2);
+        putString(disassembler->out, label->name);
+        putChar(disassembler->out, '>');
+    }
+}
+
+static void putStringOperand(Disassembler* disassembler, uint32_t offset, uint32_t end) {
+    Output* out = disassembler->out;
+    putChar(out, '"');
+    for(uint32_t i = offset; i < end && disassembler->source[i] != 0x00; i++) {
+        char c = (char)disassembler->source[i];
+        if(disassembler->sasm) {
+            // the lexer has no escapes, a quote or newline can't be written back
+            if(c == '"' || c == '\n') disassembler->lossy = true;
+            putChar(out, c);
+        } else if(c == '\n') {
+            putChars(out, "\\n", 2);
+        } else {
+            putChar(out, c);
+        }
+    }
+    putChar(out, '"');
+}
+
+// printp operands are shown as the string they print, source output writes
+// them as printcs and the assembler pools them again
+static void putPoolString(Disassembler* disassembler, uint32_t entry) {
+    if(entry + 2 > disassembler->length ||
+            entry + 2 + getOperand16(disassembler->source, entry) > disassembler->length) {
+        if(disassembler->sasm) disassembler->lossy = true;
+        putAddress(disassembler->out, entry);
+        return;
+    }
+    if(!disassembler->sasm) {
+        putAddress(disassembler->out, entry);
+        putChar(disassembler->out, ' ');
+    }
+    putStringOperand(disassembler, entry + 2, entry + 2 + getOperand16(disassembler->source, entry));
+}
+
+static void putHostFunction(Disassembler* disassembler, uint8_t index) {
+    if(index < HOST_BUILTIN_COUNT) {
+        putString(disassembler->out, hostFunctionNames[index]);
+    } else {
+        putChars(disassembler->out, "0x", 2);
+        putHex(disassembler->out, index, 2);
+    }
+}
+
+static void putBytes(Disassembler* disassembler, uint32_t offset, uint32_t length) {
+    Output* out = disassembler->out;
+    uint32_t shown = length < BYTES_SHOWN ? length : BYTES_SHOWN;
+    for(uint32_t i = 0; i < shown; i++) {
+        putHex(out, disassembler->source[offset + i], 2);
+        putChar(out, ' ');
+    }
+    putPadding(out, (int)(BYTES_SHOWN - shown) * 3 + 2);
+}
+
+// one line per entry, so printp operands can be matched up
+static void putPool(Disassembler* disassembler, uint32_t offset, uint32_t end) {
+    Output* out = disassembler->out;
+    char size[16];
+    putAddress(out, offset);
+    putPadding(out, 2);
+    putBytes(disassembler, offset, 3);
+    putString(out, "pool    ");
+    snprintf(size, sizeof(size), "%u", end - offset - 3);
+    putString(out, size);
+    putString(out, " bytes\n");
+    for(uint32_t entry = offset + 3; entry + 2 <= end;) {
+        uint32_t next = entry + 2 + getOperand16(disassembler->source, entry);
+        if(next > end) next = end;
+        putAddress(out, entry);
+        putPadding(out, 2);
+        putBytes(disassembler, entry, next - entry);
+        putStringOperand(disassembler, entry + 2, next);
+        putChar(out, '\n');
+        entry = next;
+    }
+}
+
+// short branches are written in their long form, relaxation picks the
+// encoding again when the output is assembled
+static void putOperands(Disassembler* disassembler, const InstructionInfo* info, uint32_t offset, uint32_t next) {
+    const uint8_t* source = disassembler->source;
+    Output* out = disassembler->out;
+    switch(info->layout) {
+        case LAYOUT_NONE:
+            break;
+        case LAYOUT_REG:
+            putRegister(disassembler, source[offset + 1]);
+            break;
+        case LAYOUT_REG_REG:
+            putRegister(disassembler, source[offset + 1]);
+            putChars(out, ", ", 2);
+            putRegister(disassembler, source[offset + 2]);
+            break;
+        case LAYOUT_REG_IMM:
+            putRegister(disassembler, source[offset + 1]);
+            putChars(out, ", ", 2);
+            putAddress(out, getOperand16(source, offset + 2));
+            break;
+        case LAYOUT_IMM:
+            putAddress(out, getOperand16(source, offset + 1));
+            break;
+        case LAYOUT_ADDR:
+            if(source[offset] == OP_PRINTP) putPoolString(disassembler, getOperand16(source, offset + 1));
+            else putTarget(disassembler, getOperand16(source, offset + 1));
+            break;
+        case LAYOUT_REG_ADDR:
+            putRegister(disassembler, source[offset + 1]);
+            putChars(out, ", ", 2);
+            putTarget(disassembler, getOperand16(source, offset + 2));
+            break;
+        case LAYOUT_STRING:
+            putStringOperand(disassembler, offset + 1, next);
+            break;
+        case LAYOUT_HOST:
+            putHostFunction(disassembler, source[offset + 1]);
+            break;
+        case LAYOUT_REL:
+            putTarget(disassembler, (uint16_t)(next + (int8_t)source[offset + 1]));
+            break;
+        case LAYOUT_REG_REL:
+            putRegister(disassembler, source[offset + 1]);
+            putChars(out, ", ", 2);
+            putTarget(disassembler, (uint16_t)(next + (int8_t)source[offset + 2]));
+            break;
+        case LAYOUT_REG_REG_ADDR:
+            putRegister(disassembler, source[offset + 1]);
+            putChars(out, ", ", 2);
+            putRegister(disassembler, source[offset + 2]);
+            putChars(out, ", ", 2);
+            putTarget(disassembler, getOperand16(source, offset + 3));
+            break;
+        case LAYOUT_REG_IMM_ADDR:
+            putRegister(disassembler, source[offset + 1]);
+            putChars(out, ", ", 2);
+            putAddress(out, getOperand16(source, offset + 2));
+            putChars(out, ", ", 2);
+            putTarget(disassembler, getOperand16(source, offset + 4));
+            break;
+        case LAYOUT_POOL:
+            break;
+    }
+}
+
+// the length of the instruction at offset, 0 when it is unknown or runs past
+// the end of the image
+static uint32_t decodeLength(Disassembler* disassembler, uint32_t offset) {
+    const InstructionInfo* info = &instructionInfo[disassembler->source[offset]];
+    if(info->mnemonic == NULL) return 0;
+    uint32_t length = (uint32_t)instructionLength(disassembler->source, (int)offset, (int)disassembler->length);
+    if(offset + length > disassembler->length) return 0;
+    if(info->layout == LAYOUT_STRING && disassembler->source[offset + length - 1] != 0x00) return 0;
+    return length;
+}
+
+static int32_t branchTarget(Disassembler* disassembler, uint32_t offset, uint32_t next) {
+    const uint8_t* source = disassembler->source;
+    OperandLayout layout = instructionInfo[source[offset]].layout;
+    if(addressOffset(layout)) return getOperand16(source, offset + addressOffset(layout));
+    switch(layout) {
+        case LAYOUT_REL: return (uint16_t)(next + (int8_t)source[offset + 1]);
+        case LAYOUT_REG_REL: return (uint16_t)(next + (int8_t)source[offset + 2]);
+        default: return -1;
+    }
+}
+
+#define BIT_SET(bits, index) ((bits)[(index) >> 3] |= (uint8_t)(1 << ((index) & 7)))
+#define BIT_TEST(bits, index) ((bits)[(index) >> 3] & (1 << ((index) & 7)))
+
+// without debug info every branch target that starts an instruction gets a
+// label, the target of the entry stub is main
+static void recoverLabels(Disassembler* disassembler) {
+    uint8_t* starts = calloc(disassembler->length / 8 + 1, 1);
+    uint8_t* targets = calloc(0x10000 / 8, 1);
+    if(starts == NULL || targets == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    uint32_t count = 0;
+    for(uint32_t offset = 0; offset < disassembler->length;) {
+        BIT_SET(starts, offset);
+        uint32_t length = decodeLength(disassembler, offset);
+        if(length == 0) {
+            offset++;
+            continue;
+        }
+        int32_t target = branchTarget(disassembler, offset, offset + length);
+        if(target >= 0 && !BIT_TEST(targets, target)) {
+            BIT_SET(targets, target);
+            count++;
+        }
+        offset += length;
+    }
+
+    int32_t entry = disassembler->length >= ENTRY_SIZE && disassembler->source[0] == OP_JMP ?
+        getOperand16(disassembler->source, 1) : -1;
+
+    DebugInfo* info = &disassembler->info;
+    info->labels = malloc(sizeof(DebugLabel) * (count + 1));
+    if(info->labels == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        exit(1);
+    }
+
+    for(uint32_t address = 0; address < 0x10000 && address < disassembler->length; address++) {
+        if(!BIT_TEST(targets, address) || !BIT_TEST(starts, address)) continue;
+        char* name = malloc(8);
+        if(name == NULL) {
+            fprintf(stderr, "out of memory.\n");
+            exit(1);
+        }
+        if((int32_t)address == entry) {
+            strcpy(name, "main");
+        } else {
+            name[0] = 'L';
+            name[1] = '_';
+            for(int i = 0; i < 4; i++) name[2 + i] = hexDigits[(address >> (12 - i * 4)) & 0xF];
+            name[6] = '\0';
+        }
+        info->labels[info->labelCount].name = name;
+        info->labels[info->labelCount].address = address;
+        info->labelCount++;
+    }
+
+    free(starts);
+    free(targets);
+}
+
+static void disassemble(Disassembler* disassembler) {
+    Output* out = disassembler->out;
+    const uint8_t* source = disassembler->source;
+    const DebugLabel* labels = disassembler->info.labels;
+    uint32_t labelCount = disassembler->labels ? disassembler->info.labelCount : 0;
+    uint32_t nextLabel = 0;
+
+    // the assembler writes the entry stub itself
+    uint32_t offset = 0;
+    if(disassembler->sasm && disassembler->length >= ENTRY_SIZE && source[0] == OP_JMP)
+        offset = ENTRY_SIZE;
+
+    while(offset < disassembler->length) {
+        while(nextLabel < labelCount && labels[nextLabel].address < offset) {
+            if(disassembler->sasm) disassembler->lossy = true; // inside an instruction
+            nextLabel++;
+        }
+        while(nextLabel < labelCount && labels[nextLabel].address == offset) {
+            if(!disassembler->sasm) putChar(out, '\n');
+            putString(out, labels[nextLabel].name);
+            putChars(out, ":\n", 2);
+            nextLabel++;
+        }
+
+        uint32_t length = decodeLength(disassembler, offset);
+
+        // the assembler places the pool again from the printcs it writes
+        if(length != 0 && source[offset] == OP_POOL) {
+            if(disassembler->sasm) break;
+            putPool(disassembler, offset, offset + length);
+            offset += length;
+            continue;
+        }
+
+        if(!disassembler->sasm) {
+            putAddress(out, offset);
+            putPadding(out, 2);
+            putBytes(disassembler, offset, length == 0 ? 1 : length);
+        } else {
+            putPadding(out, 4);
+        }
+
+        if(length == 0) {
+            // there is no way to write raw bytes in source
+            if(disassembler->sasm) {
+                putChars(out, "; ", 2);
+                disassembler->lossy = true;
+            }
+            putChars(out, "(bad) 0x", 8);
+            putHex(out, source[offset], 2);
+            putChar(out, '\n');
+            offset++;
+            continue;
+        }
+
+        const InstructionInfo* info = &instructionInfo[source[offset]];
+        const char* mnemonic = disassembler->sasm ? instructionInfo[longBranch(source[offset])].mnemonic : info->mnemonic;
+        if(disassembler->sasm && source[offset] == OP_PRINTP) mnemonic = instructionInfo[OP_PRINTCS].mnemonic;
+        size_t mnemonicLength = strlen(mnemonic);
+        putChars(out, mnemonic, mnemonicLength);
+        if(info->layout != LAYOUT_NONE)
+            putPadding(out, mnemonicLength < 8 ? (int)(8 - mnemonicLength) : 1);
+        putOperands(disassembler, info, offset, offset + length);
+        putChar(out, '\n');
+        offset += length;
+    }
+    flushOutput(out);
+}
+
+static void printUsage(char** argv) {
+    fprintf(stderr, "usage: %s [-l] [-s] [-o out] image\n", argv[0]);
+    fprintf(stderr, "    -l    show labels, from image.sdbg when it exists\n");
+    fprintf(stderr, "    -s    write source that synas can assemble again (implies -l)\n");
+}
+
+int main(int argc, char** argv) {
+    Disassembler disassembler;
+    memset(&disassembler, 0, sizeof(Disassembler));
+    const char* output = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "lso:")) != -1) {
+        switch(opt) {
+            case 'l': disassembler.labels = true; break;
+            case 's': disassembler.sasm = disassembler.labels = true; break;
+            case 'o': output = optarg; break;
+            default:
+                printUsage(argv);
+                return 1;
+        }
+    }
+    if(optind != argc - 1) {
+        printUsage(argv);
+        return 1;
+    }
+    const char* path = argv[optind];
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "image file `%s` does not exist.\n", path);
+        return 1;
+    }
+    disassembler.length = (uint32_t)st.st_size;
+    if(disassembler.length > 0) {
+        disassembler.source = mmap(NULL, disassembler.length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(disassembler.source == MAP_FAILED) {
+            fprintf(stderr, "error mapping image file `%s`.\n", path);
+            return 1;
+        }
+        madvise((void*)disassembler.source, disassembler.length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    if(disassembler.labels) {
+        char debugPath[PATH_MAX];
+        snprintf(debugPath, sizeof(debugPath), "%s.sdbg", path);
+        if(access(debugPath, R_OK) != 0 || !loadDebugInfo(debugPath, &disassembler.info))
+            recoverLabels(&disassembler);
+    }
+
+    Output* out = malloc(sizeof(Output));
+    if(out == NULL) {
+        fprintf(stderr, "out of memory.\n");
+        return 1;
+    }
+    out->count = 0;
+    out->file = output != NULL ? fopen(output, "w") : stdout;
+    if(out->file == NULL) {
+        fprintf(stderr, "error opening output file `%s`.\n", output);
+        return 1;
+    }
+    disassembler.out = out;
+
+    disassemble(&disassembler);
+
+    if(output != NULL) fclose(out->file);
+    if(disassembler.lossy && disassembler.sasm) {
+        fprintf(stderr, "warning: `%s` has bytes that can't be written as source, the output won't assemble to the same image.\n", path);
+        return 1;
+    }
+    return 0;
+}
@@ -1,9 +1,20 @@
+#include <pthread.h>
 #include <stdio.h>
+#include <unistd.h>
 
+#include "channel.h"
 #include "debug.h"
+#include "host.h"
 #include "vm.h"
 
-VM vm;
+_Thread_local VM vm;
+
+static HostFunction hostFunctions[HOST_MAX];
+static TrapHandler trapHandler = NULL;
+// the image spawned threads run, NULL for the spawning thread's own
+static uint8_t* threadSource = NULL;
+static ThreadHook threadHook = NULL;
+static _Atomic uint16_t sharedMemory[MEMORY_WORDS];
 
 static uint8_t READ_BYTE() {
     return vm.source[vm.ip++];
@@ -17,6 +28,44 @@ void initVM() {
     vm.source = NULL;
     vm.ip = 0;
     vm.stackTop = vm.stack;
+    resetRegisters();
+    vm.out = stdout;
+    vm.memory = sharedMemory;
+    vm.memoryTop = 0;
+    vm.group = NULL;
+    initChannels();
+    registerBuiltinHostFunctions();
+}
+
+void registerHostFunction(uint8_t index, HostFunction function) {
+    hostFunctions[index] = function;
+}
+
+void setTrapHandler(TrapHandler handler) {
+    trapHandler = handler;
+}
+
+// the debugger hands over its unpatched image, so its breakpoints only stop
+// the thread it is driving
+void setThreadSource(uint8_t* source) {
+    threadSource = source;
+}
+
+void setThreadHook(ThreadHook hook) {
+    threadHook = hook;
+}
+
+void announceThread(bool started) {
+    if(threadHook != NULL) threadHook(started);
+}
+
+// closes every window and clears the registers, along with whatever earlier
+// windows left in the register file
+void resetRegisters() {
+    vm.regs = vm.registerFile;
+    memset(vm.registerFile, 0, sizeof(uint16_t) * (vm.windowTop * WINDOW_REGS + NUM_REGS));
+    vm.windowCount = 0;
+    vm.windowTop = 0;
 }
 
 void freeVM() {
@@ -46,452 +95,1004 @@ static void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     return result;
 }
 
-void run(uint8_t* source) {
+// threads started by `spawn` run on a pool of one worker per online cpu.
+// a thread is a starting address and a copy of the spawning thread's
+// registers, it gets a stack of its own and shares the source, output and
+// memory of the thread that spawned it.
+
+typedef enum {
+    THREAD_FREE,
+    THREAD_QUEUED,              // spawned, no worker has taken it yet
+    THREAD_RUNNING,
+    THREAD_DONE,                // halted, waiting to be joined
+} ThreadState;
+
+typedef struct {
+    ThreadState state;
+    uint16_t entry;
+    uint16_t regs[NUM_REGS];
+    uint8_t* source;
+    FILE* out;
+    _Atomic uint16_t* memory;
+    ThreadGroup* group;
+    uint16_t result;            // ax when the thread halted
+} Thread;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // a thread was spawned or finished
+    Thread threads[THREAD_MAX];
+    int queue[THREAD_MAX];      // ring of thread indices in spawn order
+    int head;
+    int queued;
+} ThreadPool;
+
+static ThreadPool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER,
+};
+static pthread_once_t poolStarted = PTHREAD_ONCE_INIT;
+
+// called with the lock held
+static Thread* takeQueued() {
+    if(pool.queued == 0) return NULL;
+    Thread* thread = &pool.threads[pool.queue[pool.head]];
+    pool.head = (pool.head + 1) % THREAD_MAX;
+    pool.queued--;
+    thread->state = THREAD_RUNNING;
+    return thread;
+}
+
+// takes a thread out of the queue so its joiner can run it, called with the
+// lock held
+static void removeQueued(int index) {
+    int at = 0;
+    while(pool.queue[(pool.head + at) % THREAD_MAX] != index) at++;
+    for(; at < pool.queued - 1; at++)
+        pool.queue[(pool.head + at) % THREAD_MAX] = pool.queue[(pool.head + at + 1) % THREAD_MAX];
+    pool.queued--;
+}
+
+// what runThread replaces of the calling thread's vm. only the live part of
+// the stack and register file is copied, the rest is never read.
+typedef struct {
+    uint8_t* source;
+    uint16_t ip;
+    int stackDepth;
+    int windowCount;
+    FILE* out;
+    _Atomic uint16_t* memory;
+    int memoryTop;
+    ThreadGroup* group;
+    uint16_t stack[STACK_MAX];
+    uint16_t registers[WINDOW_MAX * WINDOW_REGS + NUM_REGS];
+    uint16_t returns[WINDOW_MAX];
+} SavedVM;
+
+static void saveVM(SavedVM* saved) {
+    saved->source = vm.source;
+    saved->ip = vm.ip;
+    saved->stackDepth = (int)(vm.stackTop - vm.stack);
+    saved->windowCount = vm.windowCount;
+    saved->out = vm.out;
+    saved->memory = vm.memory;
+    saved->memoryTop = vm.memoryTop;
+    saved->group = vm.group;
+    memcpy(saved->stack, vm.stack, sizeof(uint16_t) * saved->stackDepth);
+    memcpy(saved->registers, vm.registerFile, sizeof(uint16_t) * (vm.windowCount * WINDOW_REGS + NUM_REGS));
+    memcpy(saved->returns, vm.returns, sizeof(uint16_t) * vm.windowCount);
+}
+
+// the thread's windows stay in the register file above the caller's, so
+// windowTop keeps covering them
+static void restoreVM(const SavedVM* saved) {
+    vm.source = saved->source;
+    vm.ip = saved->ip;
+    memcpy(vm.stack, saved->stack, sizeof(uint16_t) * saved->stackDepth);
+    vm.stackTop = vm.stack + saved->stackDepth;
+    memcpy(vm.registerFile, saved->registers, sizeof(uint16_t) * (saved->windowCount * WINDOW_REGS + NUM_REGS));
+    memcpy(vm.returns, saved->returns, sizeof(uint16_t) * saved->windowCount);
+    vm.windowCount = saved->windowCount;
+    if(vm.windowTop < vm.windowCount) vm.windowTop = vm.windowCount;
+    vm.regs = vm.registerFile + vm.windowCount * WINDOW_REGS;
+    vm.out = saved->out;
+    vm.memory = saved->memory;
+    vm.memoryTop = saved->memoryTop;
+    vm.group = saved->group;
+}
+
+// runs on top of whatever the calling thread was running, so a join can do
+// the work of a thread nobody has started
+static void runThread(Thread* thread) {
+    SavedVM saved;
+    saveVM(&saved);
+    vm.source = thread->source;
+    vm.ip = thread->entry;
+    resetRegisters();
+    memcpy(vm.regs, thread->regs, sizeof(thread->regs));
+    vm.stackTop = vm.stack;
+    vm.out = thread->out;
+    vm.memory = thread->memory;
+    vm.memoryTop = 0;
+    vm.group = thread->group;
+    if(resume() == VM_TRAP) {
+        fflush(vm.out);
+        fprintf(stderr, "trap at 0x%04x in a spawned thread.\n", vm.ip);
+        exit(1);
+    }
+    uint16_t result = vm.regs[ax];
+    int memoryTop = vm.memoryTop;
+    restoreVM(&saved);
+
+    // raised before pending drops, so the run sees it once its threads are done
+    if(thread->group != NULL) {
+        int top = atomic_load(&thread->group->memoryTop);
+        while(top < memoryTop && !atomic_compare_exchange_weak(&thread->group->memoryTop, &top, memoryTop));
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    thread->result = result;
+    thread->state = THREAD_DONE;
+    if(thread->group != NULL) atomic_fetch_sub(&thread->group->pending, 1);
+    pthread_cond_broadcast(&pool.changed);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// called with the lock held. instead of sleeping, a waiting thread runs
+// queued threads itself, which also keeps a pool full of waiting workers
+// from stalling on threads none of them has started.
+static void helpUntil(bool (*finished)(void*), void* arg) {
+    while(!finished(arg)) {
+        Thread* thread = takeQueued();
+        if(thread == NULL) {
+            pthread_cond_wait(&pool.changed, &pool.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&pool.lock);
+        runThread(thread);
+        pthread_mutex_lock(&pool.lock);
+    }
+}
+
+static bool never(void* arg) {
+    (void)arg;
+    return false;
+}
+
+static void* poolWorker(void* arg) {
+    announceThread(true);
+    // runThread saves the machine it runs on top of, start from an empty one
+    vm.stackTop = vm.stack;
+    resetRegisters();
+    pthread_mutex_lock(&pool.lock);
+    helpUntil(never, NULL);
+    return NULL;
+}
+
+static void startPool() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 0 ? (int)cpus : 1;
+    for(int i = 0; i < workers; i++) {
+        pthread_t worker;
+        if(pthread_create(&worker, NULL, poolWorker, NULL) != 0) {
+            fprintf(stderr, "error starting vm thread.\n");
+            exit(1);
+        }
+        pthread_detach(worker);
+    }
+}
+
+// handles are the thread's index plus one, so 0 is never a thread
+static uint16_t spawnThread(uint16_t entry) {
+    pthread_once(&poolStarted, startPool);
+    pthread_mutex_lock(&pool.lock);
+
+    int index = 0;
+    while(index < THREAD_MAX && pool.threads[index].state != THREAD_FREE)
+        index++;
+    if(index == THREAD_MAX) {
+        fprintf(stderr, "too many threads, at most %d can be running or waiting to be joined.\n", THREAD_MAX);
+        exit(1);
+    }
+
+    Thread* thread = &pool.threads[index];
+    thread->state = THREAD_QUEUED;
+    thread->entry = entry;
+    memcpy(thread->regs, vm.regs, sizeof(thread->regs));
+    thread->source = threadSource != NULL ? threadSource : vm.source;
+    thread->out = vm.out;
+    thread->memory = vm.memory;
+    thread->group = vm.group;
+    if(thread->group != NULL) {
+        atomic_fetch_add(&thread->group->pending, 1);
+        atomic_fetch_add(&thread->group->unjoined, 1);
+    }
+
+    pool.queue[(pool.head + pool.queued) % THREAD_MAX] = index;
+    pool.queued++;
+    pthread_cond_broadcast(&pool.changed);
+    pthread_mutex_unlock(&pool.lock);
+    return (uint16_t)(index + 1);
+}
+
+static bool threadDone(void* arg) {
+    return ((Thread*)arg)->state == THREAD_DONE;
+}
+
+static uint16_t joinThread(uint16_t handle) {
+    if(handle == 0 || handle > THREAD_MAX) {
+        fprintf(stderr, "invalid thread handle %04x\n", handle);
+        exit(1);
+    }
+    Thread* thread = &pool.threads[handle - 1];
+
+    pthread_mutex_lock(&pool.lock);
+    if(thread->state == THREAD_FREE) {
+        fprintf(stderr, "thread %04x was never spawned or is already joined\n", handle);
+        exit(1);
+    }
+    if(thread->state == THREAD_QUEUED) {
+        removeQueued(handle - 1);
+        thread->state = THREAD_RUNNING;
+        pthread_mutex_unlock(&pool.lock);
+        runThread(thread);
+        pthread_mutex_lock(&pool.lock);
+    }
+    helpUntil(threadDone, thread);
+    uint16_t result = thread->result;
+    thread->state = THREAD_FREE;
+    if(thread->group != NULL) atomic_fetch_sub(&thread->group->unjoined, 1);
+    pthread_mutex_unlock(&pool.lock);
+    return result;
+}
+
+static bool groupDone(void* arg) {
+    return atomic_load(&((ThreadGroup*)arg)->pending) == 0;
+}
+
+#ifdef DEBUG_TRACE_EXEC
+#define TRACE() \
+    do { printf("\n"); disassembleInstruction(vm.source, vm.ip); } while(0)
+#else
+#define TRACE() \
+    do { } while(0)
+#endif
+
+#define CASE(name) op_##name
+
+#define DISPATCH() \
+    do { TRACE(); goto *dispatchTable[READ_BYTE()]; } while(0)
+
+// the run is over when the image halts and every thread it spawned has
+VMStatus run(uint8_t* source) {
+    ThreadGroup group;
+    atomic_init(&group.pending, 0);
+    atomic_init(&group.unjoined, 0);
+    atomic_init(&group.memoryTop, 0);
     vm.source = source;
     //vm.ip = vm.source;
     vm.ip = 0;
+    vm.group = &group;
+    VMStatus status = resume();
+    if(atomic_load(&group.pending) > 0) {
+        pthread_mutex_lock(&pool.lock);
+        helpUntil(groupDone, &group);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    // nothing can join a handle once its run is over
+    if(atomic_load(&group.unjoined) > 0) {
+        pthread_mutex_lock(&pool.lock);
+        for(int i = 0; i < THREAD_MAX; i++)
+            if(pool.threads[i].group == &group && pool.threads[i].state == THREAD_DONE)
+                pool.threads[i].state = THREAD_FREE;
+        pthread_mutex_unlock(&pool.lock);
+    }
+    if(atomic_load(&group.memoryTop) > vm.memoryTop) vm.memoryTop = atomic_load(&group.memoryTop);
+    vm.group = NULL;
+    return status;
+}
 
-    for (;;) {
-#ifdef DEBUG_TRACE_EXEC
-        printf("\n");
-        disassembleInstruction(vm.source, vm.ip);
-#endif
+// continue at vm.ip, the debugger resumes here after every trap
+VMStatus resume() {
+    // one slot per opcode, generated from the instruction table so unused
+    // opcodes land on op_UNKNOWN
+    static void* dispatchTable[256] = {
+        [0 ... 255] = &&op_UNKNOWN,
+#define OPCODE_LABEL(name, value, mnemonic, layout, flow, pops, pushes) [value] = &&op_##name,
+        OPCODES(OPCODE_LABEL)
+#undef OPCODE_LABEL
+    };
 
-        uint8_t instruction;
-        switch(instruction = READ_BYTE()) {
-            case OP_HALT:
-                return;
-            case OP_MOV: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        vm.regs[dest] = vm.regs[src];
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
-                        exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_PRINTC: {
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(src))
-                    printf("%c", vm.regs[src]);
-                else {
-                    fprintf(stderr, "invalid register %02x\n", src);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_PRINTCS: {
-                uint8_t lastchar;
-                for(;;) {
-                    lastchar = READ_BYTE();
-                    if(lastchar == 0x00) break;
-                    printf("%c", (char)lastchar);
-                }
-                break;
-            }
-            case OP_PRINTI: {
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(src)) {
-                    printf("%d", vm.regs[src]);
-                } else {
-                    fprintf(stderr, "invalid register %02x\n", src);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_PRINTH: {
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(src)) {
-                    printf("%04x", vm.regs[src]);
-                } else {
-                    fprintf(stderr, "invalid register %02x\n", src);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_SETR: {
-                uint8_t dest = READ_BYTE();
-                uint16_t data = READ_BYTE16();
-                if(VALID_REGISTER(dest)) {
-                    vm.regs[dest] = data;
-                } else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_INC: {
-                uint8_t dest = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    vm.regs[dest]++;
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_DEC: {
-                uint8_t dest = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(vm.regs[dest] > 0x0000)
-                        vm.regs[dest]--;
-                    else {
-                        fprintf(stderr, "attempted negative decrementation of register\n");
-                        exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_ADD: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        vm.regs[dest] += vm.regs[src];
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
-                        exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_SUB: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        if(vm.regs[dest] > vm.regs[src])
-                            vm.regs[dest] -= vm.regs[src];
-                        else {
-                            fprintf(stderr, "attempted negative decrementation of register\n");
-                            exit(1);
-                        }
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
-                        exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_MUL: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        vm.regs[dest] *= vm.regs[src];
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
-                        exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
+    DISPATCH();
 
-            case OP_DIV: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        if(vm.regs[dest] != 0x00)
-                            if(vm.regs[src] != 0x00)
-                                vm.regs[dest] /= vm.regs[src];
-                            else {
-                                fprintf(stderr, "attempted division by zero of register");
-                                exit(1);
-                            }
-                        else {
-                            fprintf(stderr, "attempted division by zero of register");
-                                exit(1);
-                        }
-                        
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
-                        exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_JMP: {
-                uint16_t data = READ_BYTE16();
-                vm.ip = data;
-                break;
-            }
-            case OP_JNZ: {
-                uint8_t src = READ_BYTE();
-                uint16_t data = READ_BYTE16();
-                if(VALID_REGISTER(src)) {
-                    if(vm.regs[src] > 0x00)
-                        vm.ip = data;
-                } else {
-                    fprintf(stderr, "invalid register %02x\n", src);
-                    exit(1);
-                }
-                break;
+    CASE(HALT):
+        return VM_HALT;
+    CASE(MOV): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                vm.regs[dest] = vm.regs[src];
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_JZ: {
-                uint8_t src = READ_BYTE();
-                uint16_t data = READ_BYTE16();
-                if(VALID_REGISTER(src)) {
-                    if(vm.regs[src] == 0x00)
-                        vm.ip = data;
-                } else {
-                    fprintf(stderr, "invalid register %02x\n", src);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_SHL: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        vm.regs[dest] <<= vm.regs[src];
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
-                        exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_SHR: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        vm.regs[dest] >>= vm.regs[src];
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
-                        exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_XOR: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        vm.regs[dest] ^= vm.regs[src];
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
-                        exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(PRINTC): {
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(src))
+            fputc(vm.regs[src], vm.out);
+        else {
+            fprintf(stderr, "invalid register %02x\n", src);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(PRINTCS): {
+        const char* string = (const char*)&vm.source[vm.ip];
+        size_t length = strlen(string);
+        fwrite(string, 1, length, vm.out);
+        vm.ip += length + 1;
+        DISPATCH();
+    }
+    CASE(PRINTI): {
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(src)) {
+            fprintf(vm.out, "%d", vm.regs[src]);
+        } else {
+            fprintf(stderr, "invalid register %02x\n", src);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(PRINTH): {
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(src)) {
+            fprintf(vm.out, "%04x", vm.regs[src]);
+        } else {
+            fprintf(stderr, "invalid register %02x\n", src);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(SETR): {
+        uint8_t dest = READ_BYTE();
+        uint16_t data = READ_BYTE16();
+        if(VALID_REGISTER(dest)) {
+            vm.regs[dest] = data;
+        } else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(INC): {
+        uint8_t dest = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            vm.regs[dest]++;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(DEC): {
+        uint8_t dest = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(vm.regs[dest] > 0x0000)
+                vm.regs[dest]--;
+            else {
+                fprintf(stderr, "attempted negative decrementation of register\n");
+                exit(1);
             }
-            case OP_OR: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        vm.regs[dest] |= vm.regs[src];
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
-                        exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(ADD): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                vm.regs[dest] += vm.regs[src];
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_AND: {
-                uint8_t dest = READ_BYTE();
-                uint16_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        vm.regs[dest] &= vm.regs[src];
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
-                        exit(1);
-                    }
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(SUB): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                if(vm.regs[dest] > vm.regs[src])
+                    vm.regs[dest] -= vm.regs[src];
                 else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_POP: {
-                uint16_t dest = READ_BYTE();
-                if(VALID_REGISTER(dest)) {
-                    vm.regs[dest] = pop();
-                } else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
+                    fprintf(stderr, "attempted negative decrementation of register\n");
                     exit(1);
                 }
-                break;
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_PUSH: {
-                uint16_t data = READ_BYTE16();
-                push(data);
-                break;
-            }
-            case OP_PUSHR: {
-                uint8_t reg = READ_BYTE();
-                if(VALID_REGISTER(reg)) {
-                    push(vm.regs[reg]);
-                } else {
-                    fprintf(stderr, "invalid register %02x\n", reg);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_GETIP: {
-                uint8_t reg = READ_BYTE();
-                if(VALID_REGISTER(reg)) {
-                    vm.regs[reg] = (uint16_t)((uint8_t)(0x00 << 8) | (uint8_t)vm.ip);
-                } else {
-                    fprintf(stderr, "invalid register %02x\n", reg);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_PEEK: {
-                uint8_t reg = READ_BYTE();
-                if(VALID_REGISTER(reg)) {
-                    vm.regs[reg] = pop();
-                } else {
-                    fprintf(stderr, "invalid register %02x\n", reg);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_MOD: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        vm.regs[dest] %= vm.regs[src];
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
-                        exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(MUL): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                vm.regs[dest] *= vm.regs[src];
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_LT: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        vm.regs[dest] = vm.regs[dest] < vm.regs[src] ? 1 : 0;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+
+    CASE(DIV): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                if(vm.regs[dest] != 0x00)
+                    if(vm.regs[src] != 0x00)
+                        vm.regs[dest] /= vm.regs[src];
                     else {
-                        fprintf(stderr, "invalid register %02x\n", src);
+                        fprintf(stderr, "attempted division by zero of register");
                         exit(1);
                     }
                 else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
-                }
-                break;
-            }
-            case OP_GT: {
-                uint8_t dest = READ_BYTE();
-                uint8_t src = READ_BYTE();
-                if(VALID_REGISTER(dest))
-                    if(VALID_REGISTER(src))
-                        vm.regs[dest] = vm.regs[dest] > vm.regs[src] ? 1 : 0;
-                    else {
-                        fprintf(stderr, "invalid register %02x\n", src);
+                    fprintf(stderr, "attempted division by zero of register");
                         exit(1);
-                    }
-                else {
-                    fprintf(stderr, "invalid register %02x\n", dest);
-                    exit(1);
                 }
-                break;
-            }
-            case OP_RET: {
-                vm.ip = pop();
-                break;
+                
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_CALL: {
-                uint16_t dest = READ_BYTE16();
-                push(vm.ip);
-                vm.ip = dest;
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(JMP): {
+        uint16_t data = READ_BYTE16();
+        vm.ip = data;
+        DISPATCH();
+    }
+    CASE(JNZ): {
+        uint8_t src = READ_BYTE();
+        uint16_t data = READ_BYTE16();
+        if(VALID_REGISTER(src)) {
+            if(vm.regs[src] > 0x00)
+                vm.ip = data;
+        } else {
+            fprintf(stderr, "invalid register %02x\n", src);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(JZ): {
+        uint8_t src = READ_BYTE();
+        uint16_t data = READ_BYTE16();
+        if(VALID_REGISTER(src)) {
+            if(vm.regs[src] == 0x00)
+                vm.ip = data;
+        } else {
+            fprintf(stderr, "invalid register %02x\n", src);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(SHL): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                vm.regs[dest] <<= vm.regs[src];
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_PRINTIS: {
-                printf("%d", pop());
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(SHR): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                vm.regs[dest] >>= vm.regs[src];
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_ADDS: {
-                uint16_t b = pop();
-                uint16_t a = pop();
-                push(a + b);
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(XOR): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                vm.regs[dest] ^= vm.regs[src];
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_SUBS: {
-                uint16_t b = pop();
-                uint16_t a = pop();
-                push(a - b);
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(OR): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                vm.regs[dest] |= vm.regs[src];
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_MULS: {
-                uint16_t b = pop();
-                uint16_t a = pop();
-                push(a * b);
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(AND): {
+        uint8_t dest = READ_BYTE();
+        uint16_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                vm.regs[dest] &= vm.regs[src];
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_DIVS: {
-                uint16_t b = pop();
-                uint16_t a = pop();
-                if(a == 0x00 || b == 0x00) {
-                    fprintf(stderr, "attempted division by zero.\n");
-                    exit(1);
-                }
-                push(a / b);
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(POP): {
+        uint16_t dest = READ_BYTE();
+        if(VALID_REGISTER(dest)) {
+            vm.regs[dest] = pop();
+        } else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(PUSH): {
+        uint16_t data = READ_BYTE16();
+        push(data);
+        DISPATCH();
+    }
+    CASE(PUSHR): {
+        uint8_t reg = READ_BYTE();
+        if(VALID_REGISTER(reg)) {
+            push(vm.regs[reg]);
+        } else {
+            fprintf(stderr, "invalid register %02x\n", reg);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(GETIP): {
+        uint8_t reg = READ_BYTE();
+        if(VALID_REGISTER(reg)) {
+            vm.regs[reg] = (uint16_t)((uint8_t)(0x00 << 8) | (uint8_t)vm.ip);
+        } else {
+            fprintf(stderr, "invalid register %02x\n", reg);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(PEEK): {
+        uint8_t reg = READ_BYTE();
+        if(VALID_REGISTER(reg)) {
+            vm.regs[reg] = pop();
+        } else {
+            fprintf(stderr, "invalid register %02x\n", reg);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(MOD): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                vm.regs[dest] %= vm.regs[src];
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_LTS: {
-                uint16_t b = pop();
-                uint16_t a = pop();
-                push(a < b ? 1 : 0);
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(LT): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                vm.regs[dest] = vm.regs[dest] < vm.regs[src] ? 1 : 0;
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            case OP_GTS: {
-                uint16_t b = pop();
-                uint16_t a = pop();
-                push(a > b ? 1 : 0);
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(GT): {
+        uint8_t dest = READ_BYTE();
+        uint8_t src = READ_BYTE();
+        if(VALID_REGISTER(dest))
+            if(VALID_REGISTER(src))
+                vm.regs[dest] = vm.regs[dest] > vm.regs[src] ? 1 : 0;
+            else {
+                fprintf(stderr, "invalid register %02x\n", src);
+                exit(1);
             }
-            default:
-                break;
+        else {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(RET): {
+        vm.ip = pop();
+        DISPATCH();
+    }
+    CASE(CALL): {
+        uint16_t dest = READ_BYTE16();
+        push(vm.ip);
+        vm.ip = dest;
+        DISPATCH();
+    }
+    CASE(CALLW): {
+        uint16_t dest = READ_BYTE16();
+        if(vm.windowCount == WINDOW_MAX) {
+            fprintf(stderr, "register window overflow at 0x%04x\n", vm.ip - 3);
+            exit(1);
+        }
+        vm.returns[vm.windowCount++] = vm.ip;
+        if(vm.windowCount > vm.windowTop) vm.windowTop = vm.windowCount;
+        vm.regs += WINDOW_REGS;
+        memcpy(&vm.regs[ax], vm.regs, sizeof(uint16_t) * (NUM_REGS - WINDOW_REGS));
+        vm.ip = dest;
+        DISPATCH();
+    }
+    CASE(RETW): {
+        if(vm.windowCount == 0) {
+            fprintf(stderr, "retw without a register window at 0x%04x\n", vm.ip - 1);
+            exit(1);
+        }
+        memcpy(vm.regs, &vm.regs[ax], sizeof(uint16_t) * (NUM_REGS - WINDOW_REGS));
+        vm.regs -= WINDOW_REGS;
+        vm.ip = vm.returns[--vm.windowCount];
+        DISPATCH();
+    }
+    CASE(PRINTIS): {
+        fprintf(vm.out, "%d", pop());
+        DISPATCH();
+    }
+    CASE(ADDS): {
+        uint16_t b = pop();
+        uint16_t a = pop();
+        push(a + b);
+        DISPATCH();
+    }
+    CASE(SUBS): {
+        uint16_t b = pop();
+        uint16_t a = pop();
+        push(a - b);
+        DISPATCH();
+    }
+    CASE(MULS): {
+        uint16_t b = pop();
+        uint16_t a = pop();
+        push(a * b);
+        DISPATCH();
+    }
+    CASE(DIVS): {
+        uint16_t b = pop();
+        uint16_t a = pop();
+        if(a == 0x00 || b == 0x00) {
+            fprintf(stderr, "attempted division by zero.\n");
+            exit(1);
+        }
+        push(a / b);
+        DISPATCH();
+    }
+    CASE(LTS): {
+        uint16_t b = pop();
+        uint16_t a = pop();
+        push(a < b ? 1 : 0);
+        DISPATCH();
+    }
+    CASE(GTS): {
+        uint16_t b = pop();
+        uint16_t a = pop();
+        push(a > b ? 1 : 0);
+        DISPATCH();
+    }
+    CASE(SHLS): {
+        uint16_t b = pop();
+        uint16_t a = pop();
+        push(b < 16 ? (uint16_t)(a << b) : 0);
+        DISPATCH();
+    }
+    CASE(SHRS): {
+        uint16_t b = pop();
+        uint16_t a = pop();
+        push(b < 16 ? (uint16_t)(a >> b) : 0);
+        DISPATCH();
+    }
+    CASE(SYS): {
+        uint8_t index = READ_BYTE();
+        if(hostFunctions[index] != NULL) {
+            hostFunctions[index](&vm);
+        } else {
+            fprintf(stderr, "unknown host function %02x\n", index);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(JMPS): {
+        int8_t offset = (int8_t)READ_BYTE();
+        vm.ip += offset;
+        DISPATCH();
+    }
+    CASE(JNZS): {
+        uint8_t src = READ_BYTE();
+        int8_t offset = (int8_t)READ_BYTE();
+        if(VALID_REGISTER(src)) {
+            if(vm.regs[src] > 0x00)
+                vm.ip += offset;
+        } else {
+            fprintf(stderr, "invalid register %02x\n", src);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(JZS): {
+        uint8_t src = READ_BYTE();
+        int8_t offset = (int8_t)READ_BYTE();
+        if(VALID_REGISTER(src)) {
+            if(vm.regs[src] == 0x00)
+                vm.ip += offset;
+        } else {
+            fprintf(stderr, "invalid register %02x\n", src);
+            exit(1);
+        }
+        DISPATCH();
+    }
+    CASE(CALLS): {
+        int8_t offset = (int8_t)READ_BYTE();
+        push(vm.ip);
+        vm.ip += offset;
+        DISPATCH();
+    }
+    CASE(LDS): {
+        uint8_t dest = READ_BYTE();
+        uint16_t slot = READ_BYTE16();
+        if(!VALID_REGISTER(dest)) {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        if(slot >= STACK_MAX) {
+            fprintf(stderr, "invalid stack slot %04x\n", slot);
+            exit(1);
         }
+        vm.regs[dest] = vm.stack[slot];
+        DISPATCH();
     }
-    
+    CASE(STS): {
+        uint8_t src = READ_BYTE();
+        uint16_t slot = READ_BYTE16();
+        if(!VALID_REGISTER(src)) {
+            fprintf(stderr, "invalid register %02x\n", src);
+            exit(1);
+        }
+        if(slot >= STACK_MAX) {
+            fprintf(stderr, "invalid stack slot %04x\n", slot);
+            exit(1);
+        }
+        vm.stack[slot] = vm.regs[src];
+        DISPATCH();
+    }
+    // compare and branch in one dispatch, the comparisons are unsigned like lt and gt
+#define BRANCH_REG_REG(condition) \
+    do { \
+        uint8_t a = READ_BYTE(); \
+        uint8_t b = READ_BYTE(); \
+        uint16_t dest = READ_BYTE16(); \
+        if(!VALID_REGISTER(a) || !VALID_REGISTER(b)) { \
+            fprintf(stderr, "invalid register %02x\n", VALID_REGISTER(a) ? b : a); \
+            exit(1); \
+        } \
+        if(vm.regs[a] condition vm.regs[b]) vm.ip = dest; \
+        DISPATCH(); \
+    } while(0)
+#define BRANCH_REG_IMM(condition) \
+    do { \
+        uint8_t a = READ_BYTE(); \
+        uint16_t value = READ_BYTE16(); \
+        uint16_t dest = READ_BYTE16(); \
+        if(!VALID_REGISTER(a)) { \
+            fprintf(stderr, "invalid register %02x\n", a); \
+            exit(1); \
+        } \
+        if(vm.regs[a] condition value) vm.ip = dest; \
+        DISPATCH(); \
+    } while(0)
+    CASE(JLT): BRANCH_REG_REG(<);
+    CASE(JGT): BRANCH_REG_REG(>);
+    CASE(JEQ): BRANCH_REG_REG(==);
+    CASE(JNE): BRANCH_REG_REG(!=);
+    CASE(JLE): BRANCH_REG_REG(<=);
+    CASE(JGE): BRANCH_REG_REG(>=);
+    CASE(JLTI): BRANCH_REG_IMM(<);
+    CASE(JGTI): BRANCH_REG_IMM(>);
+    CASE(JEQI): BRANCH_REG_IMM(==);
+    CASE(JNEI): BRANCH_REG_IMM(!=);
+    CASE(JLEI): BRANCH_REG_IMM(<=);
+    CASE(JGEI): BRANCH_REG_IMM(>=);
+#undef BRANCH_REG_REG
+#undef BRANCH_REG_IMM
+    CASE(SPAWN): {
+        uint8_t dest = READ_BYTE();
+        uint16_t entry = READ_BYTE16();
+        if(!VALID_REGISTER(dest)) {
+            fprintf(stderr, "invalid register %02x\n", dest);
+            exit(1);
+        }
+        vm.regs[dest] = spawnThread(entry);
+        DISPATCH();
+    }
+    CASE(JOIN): {
+        uint8_t reg = READ_BYTE();
+        if(!VALID_REGISTER(reg)) {
+            fprintf(stderr, "invalid register %02x\n", reg);
+            exit(1);
+        }
+        vm.regs[reg] = joinThread(vm.regs[reg]);
+        DISPATCH();
+    }
+    // memory instructions take a value register, then the register holding
+    // the address of the word
+#define MEMORY_OPERANDS() \
+    uint8_t reg = READ_BYTE(); \
+    uint8_t addr = READ_BYTE(); \
+    if(!VALID_REGISTER(reg) || !VALID_REGISTER(addr)) { \
+        fprintf(stderr, "invalid register %02x\n", VALID_REGISTER(reg) ? addr : reg); \
+        exit(1); \
+    } \
+    if(vm.regs[addr] >= MEMORY_WORDS) { \
+        fprintf(stderr, "invalid memory address %04x\n", vm.regs[addr]); \
+        exit(1); \
+    } \
+    _Atomic uint16_t* word = &vm.memory[vm.regs[addr]]
+// stores keep track of how far into memory they reached, so batch mode only
+// clears that much between records
+#define MARK_STORED() \
+    if(vm.regs[addr] >= vm.memoryTop) vm.memoryTop = vm.regs[addr] + 1
+    CASE(LD): {
+        MEMORY_OPERANDS();
+        vm.regs[reg] = atomic_load_explicit(word, memory_order_acquire);
+        DISPATCH();
+    }
+    CASE(ST): {
+        MEMORY_OPERANDS();
+        MARK_STORED();
+        atomic_store_explicit(word, vm.regs[reg], memory_order_release);
+        DISPATCH();
+    }
+    CASE(XADD): {
+        MEMORY_OPERANDS();
+        MARK_STORED();
+        vm.regs[reg] = atomic_fetch_add(word, vm.regs[reg]);
+        DISPATCH();
+    }
+    CASE(CAS): {
+        MEMORY_OPERANDS();
+        MARK_STORED();
+        uint16_t expected = vm.regs[ax];
+        atomic_compare_exchange_strong(word, &expected, vm.regs[reg]);
+        vm.regs[ax] = expected;
+        DISPATCH();
+    }
+#undef MEMORY_OPERANDS
+#undef MARK_STORED
+    // channel instructions take a value register, then the register holding
+    // the channel number
+#define CHANNEL_OPERANDS() \
+    uint8_t reg = READ_BYTE(); \
+    uint8_t channel = READ_BYTE(); \
+    if(!VALID_REGISTER(reg) || !VALID_REGISTER(channel)) { \
+        fprintf(stderr, "invalid register %02x\n", VALID_REGISTER(reg) ? channel : reg); \
+        exit(1); \
+    } \
+    if(vm.regs[channel] >= CHANNEL_MAX) { \
+        fprintf(stderr, "invalid channel %04x\n", vm.regs[channel]); \
+        exit(1); \
+    }
+    CASE(SEND): {
+        CHANNEL_OPERANDS();
+        channelSend(vm.regs[channel], vm.regs[reg]);
+        DISPATCH();
+    }
+    CASE(RECV): {
+        CHANNEL_OPERANDS();
+        uint16_t dest = READ_BYTE16();
+        if(!channelReceive(vm.regs[channel], &vm.regs[reg], true)) vm.ip = dest;
+        DISPATCH();
+    }
+    CASE(TRYRECV): {
+        CHANNEL_OPERANDS();
+        uint16_t dest = READ_BYTE16();
+        if(!channelReceive(vm.regs[channel], &vm.regs[reg], false)) vm.ip = dest;
+        DISPATCH();
+    }
+#undef CHANNEL_OPERANDS
+    CASE(PRINTP): {
+        uint16_t entry = READ_BYTE16();
+        uint16_t length = (uint16_t)((vm.source[entry] << 8) | vm.source[entry + 1]);
+        fwrite(&vm.source[entry + 2], 1, length, vm.out);
+        DISPATCH();
+    }
+    CASE(POOL):
+        fprintf(stderr, "ran into the string pool at 0x%04x\n", vm.ip - 1);
+        exit(1);
+    CASE(FENCE): {
+        atomic_thread_fence(memory_order_seq_cst);
+        DISPATCH();
+    }
+    CASE(TRAP):
+        vm.ip--;
+        if(trapHandler != NULL && trapHandler(vm.ip)) DISPATCH();
+        return VM_TRAP;
+    CASE(UNKNOWN):
+        fprintf(stderr, "unknown opcode %02x at 0x%04x\n", vm.source[vm.ip - 1], vm.ip - 1);
+        exit(1);
 }
\ No newline at end of file